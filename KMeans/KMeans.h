@@ -10,19 +10,50 @@ Contains
 --------
 
 Utility Fcns 
-* discrete_rand : sampling discrete random variable
-* select_without_replacement : sample without replacement
+* discrete_rand : sampling discrete random variable (prefix sum + bisection)
+* DiscreteSampler : repeated O(log N) draws from one distribution
+* select_without_replacement : sample without replacement (Floyd)
 
 Cluster Location Mu Initialization:
 * sampleRowsRandom : sample rows of X at random (w/out replacement)
 * sampleRowsPlusPlus : sample rows of X via kmeans++ procedure of Arthur et al.
     see http://en.wikipedia.org/wiki/K-means%2B%2B
+* sampleRowsPlusPlusSubset : kmeans++ on a uniform subsample of X ("sampled")
+* sampleRowsScalable : k-means|| of Bahmani et al., a few parallel
+    oversampling rounds reclustered to K ("scalable")
 
 K-Means Algorithm (aka Lloyd's Algorithm)
-* run_lloyd : executes lloyd for specfied number of iterations
+* run_lloyd : executes lloyd until converged (moved points / objective
+    change under a tolerance) or for the specified number of iterations;
+    centroid sums are updated for moved points only
+* assign_rows_fixed : fused distance + argmin for a compile-time D,
+    picked once per run by fixed_dim_kernel (D in 2..32)
+* CentroidTree : k-d tree over the centroids, rebuilt per iteration; exact
+    nearest-centroid search for run_lloyd at large K and small D
+* run_hamerly : same fixed points as lloyd, skipping distance evaluations
+    ruled out by one upper and one lower bound per point (Hamerly 2010)
+* run_elkan : same, with one lower bound per point and cluster and the
+    full centroid-to-centroid distance table (Elkan 2003)
+* run_minibatch : mini-batch updates with per-centroid learning rates,
+    then one streamed full assignment; never builds the N x K distances
+* run_kmeans : pick one of the above by name
+    ("lloyd", "hamerly", "elkan", "minibatch"); the tolerances reach lloyd
+    only, the other schemes run to their own stopping rule
+* KMeansWorkspace : scratch of plusplus + run_lloyd, reusable across runs
+
+Parallel execution
+  Assignment and centroid updates split the N rows into nThreads fixed,
+  contiguous ranges (see row_range). Per-range partial results are reduced
+  in range order, so output is bit-for-bit identical for a given nThreads
+  and seed, whether or not the build has OpenMP enabled.
+
+Random numbers
+  Every sampling routine draws from an mt_state passed in by the caller,
+  never from the global generator, so concurrent runs do not interfere.
 
 External "C" function interfaces (for calling from Python)
 * RunKMeans          : compute cluster centers and assignments via lloyd
+* RunKMeansMultiRestart : best of nInit independently seeded restarts
 * SampleRowsPlusPlus : get just a plusplus initialization
 
 Dependencies:
@@ -34,9 +65,16 @@ Date:   2 April 2013
 
 #pragma once
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <numeric>
+#include <set>
+#include <vector>
 // #include "KMeansRexCoreInterface.h"
 #include "mersenneTwister2002.c"
+#include "../parallel.h"
+#include "../profiler.h"
 #include "../Eigen/Dense"
 
 using namespace Eigen;
@@ -49,71 +87,435 @@ typedef Map<ArrayXXd> ExtMat;
 typedef ArrayXXd Mat;
 typedef ArrayXd Vec;
 
+/*  Same, for any scalar type. The Lloyd path (plusplus init, distances,
+    assignment, centroid update) is templated on it, so it runs in float as
+    well; accumulated objectives stay in double.
+*/
+template <typename Scalar> using ExtMatT = Map<Array<Scalar, Dynamic, Dynamic>>;
+template <typename Scalar> using MatT = Array<Scalar, Dynamic, Dynamic>;
+template <typename Scalar> using VecT = Array<Scalar, Dynamic, 1>;
+typedef Array<double, Dynamic, Dynamic, RowMajor> RowMat;
+
 // ====================================================== Utility Functions
+/*
+ * Rows [begin, end) handled by range t of nRanges.
+ */
+void row_range( int N, int t, int nRanges, int &begin, int &end ) {
+    begin = (int) ((long long) N * t / nRanges);
+    end = (int) ((long long) N * (t + 1) / nRanges);
+}
+
 void set_seed( int seed ) {
   init_genrand( seed );
 }
 
+/*
+ * Seed of restart r derived from the base seed (splitmix64 mixing).
+ * Restart 0 keeps the base seed, so one restart reproduces RunKMeans.
+ */
+unsigned long restart_seed( int seed, int r ) {
+    if (r == 0) return (unsigned long) seed;
+    unsigned long long key = (unsigned long long) (unsigned int) seed + 0x9e3779b97f4a7c15ULL * r;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return (unsigned long) ((key ^ (key >> 31)) & 0xffffffffUL);
+}
+
 /*
  * Return random integers from `low` (inclusive) to `high` (exclusive).
  */
-int randint(int low, int high) {
-    double r = ((high - low)) * genrand_double();
+int randint(int low, int high, mt_state &rng) {
+    double r = ((high - low)) * genrand_double_r( &rng );
     int rint = (int) r; // [0,1) -> 0, [1,2) -> 1, etc
-    return rint + low;
-}
-
-int discrete_rand( Vec &p ) {
-    double total = p.sum();
-    int K = (int) p.size();
-    
-    double r = total*genrand_double();
-    double cursum = p(0);
-    int newk = 0;
-    while ( r >= cursum && newk < K-1) {
-        newk++;
-        cursum += p[newk];
-    }
-    if ( newk < 0 || newk >= K ) {
-        cerr << "Badness. Chose illegal discrete value." << endl;
-        return -1;
-    }
-    return newk;
-}
-
-void select_without_replacement( int N, int K, Vec &chosenIDs) {
-    Vec p = Vec::Ones(N);
-    for (int kk =0; kk<K; kk++) {
-        int choice;
-        int doKeep = false;
-        while ( doKeep==false) {
-            doKeep=true;
-            choice = discrete_rand( p );
-      
-            for (int previd=0; previd<kk; previd++) {
-                if (chosenIDs[previd] == choice ) {
-                doKeep = false;
-                break;
-                }
-            }      
-        }      
-        chosenIDs[kk] = choice;     
+    return min( rint, high - low - 1 ) + low; // genrand_double can return 1
+}
+
+/*
+ * Draws from the discrete distribution with weights p: an O(N) prefix sum
+ * once, then a binary search per draw.
+ */
+class DiscreteSampler {
+public:
+    DiscreteSampler() {}
+
+    DiscreteSampler( const Vec &p ) {
+        reset( p );
+    }
+
+    // Rebuild for new weights; reuses the prefix-sum buffer. The prefix
+    // sum is always accumulated in double.
+    template <typename Weights>
+    void reset( const Weights &p ) {
+        cumsum.resize( p.size() );
+        double sum = 0;
+        for (int ii=0; ii<p.size(); ii++) {
+            sum += p[ii];
+            cumsum[ii] = sum;
+        }
     }
+
+    int draw( mt_state &rng ) {
+        return find( cumsum.back() * genrand_double_r( &rng ) );
+    }
+
+    // First index whose cumulative weight exceeds r.
+    int find( double r ) const {
+        int k = (int) (upper_bound( cumsum.begin(), cumsum.end(), r ) - cumsum.begin());
+        return min( k, (int) cumsum.size() - 1 );
+    }
+
+private:
+    vector<double> cumsum;
+};
+
+int discrete_rand( Vec &p, mt_state &rng ) {
+    DiscreteSampler sampler( p );
+    return sampler.find( p.sum() * genrand_double_r( &rng ) );
+}
+
+/*
+ * K distinct ids from [0, N) in O(K log K), by Floyd's algorithm.
+ */
+void select_without_replacement( int N, int K, Vec &chosenIDs, mt_state &rng ) {
+    set<int> chosen;
+    int kk = 0;
+    for (int jj=N-K; jj<N; jj++) {
+        int choice = randint(0, jj+1, rng);
+        if (!chosen.insert( choice ).second) {
+            choice = jj;
+            chosen.insert( choice );
+        }
+        chosenIDs[kk++] = choice;
+    }
+}
+
+/*
+ * Uniform double in [0,1) from a 64-bit key (splitmix64 finalizer), so a
+ * row's coin flip does not depend on which thread handles it.
+ */
+double hash_uniform( unsigned long long key ) {
+    key += 0x9e3779b97f4a7c15ULL;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    key = key ^ (key >> 31);
+    return (key >> 11) * (1.0 / 9007199254740992.0);
 }
 
 // ======================================================= Init Cluster Locs Mu
 
-void sampleRowsRandom( ExtMat &X, ExtMat &Mu ) {
+void sampleRowsRandom( ExtMat &X, ExtMat &Mu, mt_state &rng ) {
     int N = X.rows();
     int K = Mu.rows();
     Vec ChosenIDs = Vec::Zero(K);
-    select_without_replacement(N, K, ChosenIDs);
+    select_without_replacement(N, K, ChosenIDs, rng);
     for (int kk=0; kk<K; kk++) {
         Mu.row( kk ) = X.row( ChosenIDs[kk] );
     }
 }
 
-void sampleRowsPlusPlus( ExtMat &X, ExtMat &Mu ) {
+// ======================================================= Fixed-dimension kernels
+/*
+ * The embedding dimension D is the number of singular vectors kept, small
+ * and known before k-means starts. For D in [FixedDimMin, FixedDimMax]
+ * run_lloyd assigns points with assign_rows_fixed<Scalar, D>: each row of
+ * X is held in D registers while the squared distances to a block of
+ * FixedDimLanes centroids are formed lane by lane, and the running argmin
+ * is updated in the same pass, so the N x K distances are never stored.
+ *
+ * Centroids are packed block by block, dimension-major inside a block
+ * (MuBlocked[(b*D + d)*FixedDimLanes + l] = Mu(b*FixedDimLanes + l, d)),
+ * so the lane loop is a unit-stride vector operation. Squared differences
+ * are summed in the order Eigen's rowwise().sum() uses, and ties go to the
+ * lowest centroid as with minCoeff.
+ *
+ * For D <= 16 this reproduces the rowwise distances pairwise_distance_rows
+ * computes, so labels are unchanged there. For D in 17..32 the distances
+ * used to come from the matrix-product form |Mu|^2 - 2 X Mu^T, which sums
+ * in another order and cancels; labels there can differ on ties and near
+ * ties (the fused form being the exact one), not elsewhere.
+ */
+const int FixedDimMin = 2;
+const int FixedDimMax = 32;
+const int FixedDimLanes = 8;
+
+template <typename Scalar>
+using AssignRowsFn = double (*)( const Scalar *X, int N, const Scalar *MuBlocked, int K, Scalar *Z, int begin, int end );
+
+inline int fixed_dim_blocks( int K ) {
+    return (K + FixedDimLanes - 1) / FixedDimLanes;
+}
+
+template <typename Scalar, int D>
+double assign_rows_fixed( const Scalar *X, int N, const Scalar *MuBlocked, int K, Scalar *Z, int begin, int end ) {
+    const int W = FixedDimLanes;
+    const int size4 = (D - 1) & ~3;
+    int nBlocks = fixed_dim_blocks( K );
+    double totalDist = 0;
+    for (int nn=begin; nn<end; nn++) {
+        Scalar x[D];
+        for (int d=0; d<D; d++) {
+            x[d] = X[nn + (size_t) d*N];
+        }
+        Scalar best = numeric_limits<Scalar>::infinity();
+        int bestID = 0;
+        for (int b=0; b<nBlocks; b++) {
+            const Scalar *M = MuBlocked + (size_t) b*D*W;
+            Scalar dist[W];
+            for (int l=0; l<W; l++) {
+                Scalar diff = x[0] - M[l];
+                dist[l] = diff*diff;
+            }
+            int d = 1;
+            for (; d<size4; d+=4) {
+                for (int l=0; l<W; l++) {
+                    Scalar d0 = x[d] - M[d*W + l];
+                    Scalar d1 = x[d+1] - M[(d+1)*W + l];
+                    Scalar d2 = x[d+2] - M[(d+2)*W + l];
+                    Scalar d3 = x[d+3] - M[(d+3)*W + l];
+                    dist[l] = dist[l] + ((d0*d0 + d1*d1) + (d2*d2 + d3*d3));
+                }
+            }
+            for (; d<D; d++) {
+                for (int l=0; l<W; l++) {
+                    Scalar diff = x[d] - M[d*W + l];
+                    dist[l] = dist[l] + diff*diff;
+                }
+            }
+            int nLanes = min( W, K - b*W );
+            for (int l=0; l<nLanes; l++) {
+                if (dist[l] < best) {
+                    best = dist[l];
+                    bestID = b*W + l;
+                }
+            }
+        }
+        Z[nn] = bestID;
+        totalDist += best;
+    }
+    return totalDist;
+}
+
+/*
+ * Kernel for dimension D, or nullptr when D has none. Called once per run.
+ */
+template <typename Scalar, int Dim = FixedDimMax>
+AssignRowsFn<Scalar> fixed_dim_kernel( int D ) {
+    if constexpr (Dim < FixedDimMin) {
+        return nullptr;
+    } else {
+        return D == Dim ? &assign_rows_fixed<Scalar, Dim> : fixed_dim_kernel<Scalar, Dim-1>( D );
+    }
+}
+
+template <typename Scalar>
+void pack_centroids( ExtMatT<Scalar> &Mu, VecT<Scalar> &MuBlocked ) {
+    const int W = FixedDimLanes;
+    int K = Mu.rows();
+    int D = Mu.cols();
+    MuBlocked.setZero( (Index) fixed_dim_blocks( K ) * D * W );
+    for (int kk=0; kk<K; kk++) {
+        for (int d=0; d<D; d++) {
+            MuBlocked[((kk / W)*D + d)*W + kk % W] = Mu(kk, d);
+        }
+    }
+}
+
+// ======================================================= Centroid index (k-d tree)
+/*
+ * For many centroids in few dimensions, scanning all K centroids per point
+ * dominates Lloyd. CentroidTree is a k-d tree over Mu, rebuilt every
+ * iteration (O(K log K), cheap as K << N): each node splits its centroids
+ * at the median of the dimension they spread most in, leaves hold up to
+ * CentroidTreeLeaf of them, stored contiguously. A query descends to the
+ * point's side first and only visits the far side when the point's
+ * distance to the splitting plane does not exceed the best distance so far.
+ *
+ * The search is exact and gives the same labels as the brute-force
+ * kernels: leaf distances are summed in assign_rows_fixed's order, a
+ * computed plane distance never exceeds a computed point distance beyond
+ * it, and ties go to the lowest centroid. run_lloyd uses the tree when
+ * use_centroid_tree( K, D ) (bench/centroid_index.cpp measures where it
+ * beats the fixed-dimension kernel).
+ */
+const int CentroidTreeMinK = 64;
+const int CentroidTreeMaxDim = 8;
+const int CentroidTreeLeaf = 8;
+
+inline bool use_centroid_tree( int K, int D ) {
+    return K >= CentroidTreeMinK && D <= CentroidTreeMaxDim;
+}
+
+/*
+ * Squared distance of x to y, summed in the order of assign_rows_fixed.
+ */
+template <typename Scalar>
+inline Scalar fixed_order_dist( const Scalar *x, const Scalar *y, int D ) {
+    Scalar diff = x[0] - y[0];
+    Scalar dist = diff*diff;
+    int size4 = (D - 1) & ~3;
+    int d = 1;
+    for (; d<size4; d+=4) {
+        Scalar d0 = x[d] - y[d];
+        Scalar d1 = x[d+1] - y[d+1];
+        Scalar d2 = x[d+2] - y[d+2];
+        Scalar d3 = x[d+3] - y[d+3];
+        dist = dist + ((d0*d0 + d1*d1) + (d2*d2 + d3*d3));
+    }
+    for (; d<D; d++) {
+        diff = x[d] - y[d];
+        dist = dist + diff*diff;
+    }
+    return dist;
+}
+
+template <typename Scalar>
+struct CentroidTree {
+    struct Node {
+        int begin, end;     // range of `order` below this node
+        int dim;            // split dimension, -1 for a leaf
+        int left, right;
+        Scalar split;
+    };
+    vector<Node> nodes;
+    vector<int> order;      // centroid IDs, leaf by leaf
+    VecT<Scalar> points;    // centroids in `order`, row-major
+    int D = 0;
+
+    void reserve( int K, int dims ) {
+        nodes.reserve( 2 * (K / (CentroidTreeLeaf / 2) + 1) );  // leaves hold at least half a leaf
+        order.resize( K );
+        points.resize( (Index) K * dims );
+    }
+
+    void build( ExtMatT<Scalar> &Mu ) {
+        int K = Mu.rows();
+        D = Mu.cols();
+        order.resize( K );
+        iota( order.begin(), order.end(), 0 );
+        nodes.clear();
+        build_node( Mu, 0, K );
+        points.resize( (Index) K * D );
+        for (int ii=0; ii<K; ii++) {
+            for (int d=0; d<D; d++) {
+                points[(Index) ii*D + d] = Mu(order[ii], d);
+            }
+        }
+    }
+
+    /*
+     * Nearest centroid of x (D values): its ID, and the squared distance.
+     */
+    void nearest( const Scalar *x, Scalar &best, int &bestID ) const {
+        best = numeric_limits<Scalar>::infinity();
+        bestID = 0;
+        search( 0, x, best, bestID );
+    }
+
+private:
+    int build_node( ExtMatT<Scalar> &Mu, int begin, int end ) {
+        int id = nodes.size();
+        nodes.push_back( Node{ begin, end, -1, -1, -1, 0 } );
+        if (end - begin <= CentroidTreeLeaf) {
+            return id;
+        }
+        int dim = 0;
+        Scalar widest = -1;
+        for (int d=0; d<D; d++) {
+            Scalar lo = numeric_limits<Scalar>::infinity();
+            Scalar hi = -lo;
+            for (int ii=begin; ii<end; ii++) {
+                lo = min( lo, Mu(order[ii], d) );
+                hi = max( hi, Mu(order[ii], d) );
+            }
+            if (hi - lo > widest) {
+                widest = hi - lo;
+                dim = d;
+            }
+        }
+        int mid = begin + (end - begin) / 2;
+        nth_element( order.begin() + begin, order.begin() + mid, order.begin() + end,
+            [&]( int a, int b ) { return Mu(a, dim) < Mu(b, dim) || (Mu(a, dim) == Mu(b, dim) && a < b); } );
+        Scalar split = Mu(order[mid], dim);
+        int left = build_node( Mu, begin, mid );
+        int right = build_node( Mu, mid, end );
+        nodes[id].dim = dim;
+        nodes[id].split = split;
+        nodes[id].left = left;
+        nodes[id].right = right;
+        return id;
+    }
+
+    void search( int id, const Scalar *x, Scalar &best, int &bestID ) const {
+        const Node &node = nodes[id];
+        if (node.dim < 0) {
+            for (int ii=node.begin; ii<node.end; ii++) {
+                Scalar dist = fixed_order_dist( x, points.data() + (Index) ii*D, D );
+                if (dist < best || (dist == best && order[ii] < bestID)) {
+                    best = dist;
+                    bestID = order[ii];
+                }
+            }
+            return;
+        }
+        Scalar diff = x[node.dim] - node.split;
+        search( diff < 0 ? node.left : node.right, x, best, bestID );
+        if (diff*diff <= best) {
+            search( diff < 0 ? node.right : node.left, x, best, bestID );
+        }
+    }
+};
+
+/*
+ * Scratch buffers of the Lloyd path (plusplus init + run_lloyd), kept by
+ * callers that run k-means repeatedly. Sized by reserve(); runs with the
+ * same N, K, D and nThreads then allocate nothing.
+ */
+template <typename Scalar>
+struct KMeansWorkspaceT {
+    MatT<Scalar> Dist;      // unused when D has a fixed-dimension kernel
+    VecT<Scalar> MuBlocked; // centroids packed for the fixed-dimension kernel
+    CentroidTree<Scalar> tree; // used instead of both when use_centroid_tree
+    VecT<Scalar> minDist;
+    VecT<Scalar> curDist;
+    DiscreteSampler sampler;
+    vector<MatT<Scalar>> partialMu;
+    vector<VecT<Scalar>> partialN;
+    vector<double> partialDist;
+    VecT<Scalar> NperCluster;
+    ArrayXi Zprev;          // labels the running sums were built from
+    ArrayXXd sumMu;         // running per-cluster sums and counts, in double
+    ArrayXd countMu;
+    vector<long> partialMoved;
+
+    void reserve( int N, int K, int D, int nThreads ) {
+        if (use_centroid_tree( K, D )) {
+            tree.reserve( K, D );
+        } else if (fixed_dim_kernel<Scalar>( D ) == nullptr) {
+            Dist.resize( N, K );
+        } else {
+            MuBlocked.resize( (Index) fixed_dim_blocks( K ) * D * FixedDimLanes );
+        }
+        minDist.resize( N );
+        curDist.resize( N );
+        partialMu.resize( nThreads );
+        partialN.resize( nThreads );
+        for (int t=0; t<nThreads; t++) {
+            partialMu[t].resize( K, D );
+            partialN[t].resize( K );
+        }
+        partialDist.resize( nThreads );
+        NperCluster.resize( K );
+        Zprev.resize( N );
+        sumMu.resize( K, D );
+        countMu.resize( K );
+        partialMoved.resize( nThreads );
+    }
+};
+
+typedef KMeansWorkspaceT<double> KMeansWorkspace;
+
+template <typename Scalar>
+void sampleRowsPlusPlus( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, mt_state &rng, KMeansWorkspaceT<Scalar> &ws ) {
     int N = X.rows();
     int K = Mu.rows();
     if (K > N) {
@@ -122,10 +524,10 @@ void sampleRowsPlusPlus( ExtMat &X, ExtMat &Mu ) {
         // and leave all remaining rows of Mu uninitialized.
         K = N;
     }
-    int choice = randint(0, N); 
+    int choice = randint(0, N, rng); 
     Mu.row(0) = X.row( choice );
-    Vec minDist(N);
-    Vec curDist(N);
+    VecT<Scalar> &minDist = ws.minDist;
+    VecT<Scalar> &curDist = ws.curDist;
     for (int kk=1; kk<K; kk++) {
         curDist = (X.rowwise() - Mu.row(kk-1)).square().rowwise().sum();
         if (kk==1) {
@@ -133,78 +535,794 @@ void sampleRowsPlusPlus( ExtMat &X, ExtMat &Mu ) {
         } else {
             minDist = curDist.min( minDist );
         }      
-        choice = discrete_rand( minDist );
+        // same draw as discrete_rand, without a fresh prefix-sum buffer
+        ws.sampler.reset( minDist );
+        choice = ws.sampler.find( minDist.sum() * genrand_double_r( &rng ) );
         Mu.row(kk) = X.row( choice );
     }       
 }
 
-void init_Mu( ExtMat &X, ExtMat &Mu, const char* initname ) {		  
-    if (string(initname) == "random") {
-        sampleRowsRandom( X, Mu );
-    } else if (string(initname) == "plusplus") {
-        sampleRowsPlusPlus( X, Mu );
+template <typename Scalar>
+void sampleRowsPlusPlus( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, mt_state &rng ) {
+    KMeansWorkspaceT<Scalar> ws;
+    ws.minDist.resize( X.rows() );
+    ws.curDist.resize( X.rows() );
+    sampleRowsPlusPlus( X, Mu, rng, ws );
+}
+
+/*
+ * kmeans++ on a uniform subsample of nSample rows (with replacement),
+ * for inputs where K passes over all of X are too expensive.
+ */
+void sampleRowsPlusPlusSubset( ExtMat &X, ExtMat &Mu, int nSample, mt_state &rng ) {
+    int N = X.rows();
+    nSample = max( min(nSample, N), (int) Mu.rows() );
+    Mat Sample( nSample, X.cols() );
+    for (int nn=0; nn<nSample; nn++) {
+        Sample.row(nn) = X.row( randint(0, N, rng) );
     }
+    ExtMat SampleMap( Sample.data(), nSample, X.cols() );
+    sampleRowsPlusPlus( SampleMap, Mu, rng );
 }
 
 // ======================================================= Update Assignments Z
-void pairwise_distance( ExtMat &X, ExtMat &Mu, Mat &Dist ) {
-    int N = X.rows();
+// Bytes of each operand block of the distance product: half Eigen's stack
+// allocation limit, below which it packs operands without allocating.
+const size_t gemm_block_bytes = EIGEN_STACK_ALLOCATION_LIMIT / 2;
+
+// Largest D for which pairwise_distance_rows sums squared differences.
+const int rowwise_dist_max = 16;
+
+/*
+ * Squared distances of rows [begin, end) of X to every row of Mu, written
+ * to Dist starting at row distRow (begin by default). useGemm forces the
+ * matrix-product form, which wins for many centroids whatever D is. That
+ * form (always used above rowwise_dist_max) leaves out the |x|^2 term,
+ * which does not change the closest centroid.
+ */
+template <typename Scalar>
+void pairwise_distance_rows( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, MatT<Scalar> &Dist, int begin, int end, int distRow=-1, bool useGemm=false ) {
+    int n = end - begin;
+    if (distRow < 0) distRow = begin;
     int D = X.cols();
     int K = Mu.rows();
 
     // For small dims D, for loop is noticeably faster than fully vectorized.
     // Odd but true.  So we do fastest thing 
-    if ( D <= 16 ) {
+    if ( D <= rowwise_dist_max && !useGemm ) {
         for (int kk=0; kk<K; kk++) {
-            Dist.col(kk) = (X.rowwise() - Mu.row(kk)).square().rowwise().sum();
+            Dist.block(distRow, kk, n, 1) = (X.middleRows(begin, n).rowwise() - Mu.row(kk)).square().rowwise().sum();
         }    
     } else {
-        Dist = -2*(X.matrix() * Mu.transpose().matrix());
-        Dist.rowwise() += Mu.square().rowwise().sum().transpose().row(0);
+        // The product goes straight into Dist in blocks of rows and centroids
+        // small enough for Eigen to pack its operands on the stack, so the
+        // Lloyd step does not allocate.
+        int block = max( 1, (int) (gemm_block_bytes / ( (size_t) max( D, 1 ) * sizeof(Scalar) )) );
+        for (int b=0; b<n; b+=block) {
+            int m = min( block, n - b );
+            for (int c=0; c<K; c+=block) {
+                int kc = min( block, K - c );
+                Dist.block(distRow + b, c, m, kc).matrix().noalias() =
+                    X.middleRows(begin + b, m).matrix() * Mu.middleRows(c, kc).transpose().matrix();
+            }
+        }
+        for (int kk=0; kk<K; kk++) {
+            Dist.block(distRow, kk, n, 1) = -2*Dist.block(distRow, kk, n, 1) + Mu.row(kk).square().sum();
+        }
     }
 }
 
-double assignClosest( ExtMat &X, ExtMat &Mu, ExtMat &Z, Mat &Dist) {
+template <typename Scalar>
+void pairwise_distance( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, MatT<Scalar> &Dist, int nThreads=1 ) {
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t=0; t<nThreads; t++) {
+        int begin, end;
+        row_range( X.rows(), t, nThreads, begin, end );
+        pairwise_distance_rows( X, Mu, Dist, begin, end );
+    }
+}
+
+template <typename Scalar>
+double assignClosest( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, ExtMatT<Scalar> &Z, MatT<Scalar> &Dist, vector<double> &partialDist, int nThreads ) {
+    partialDist.assign( nThreads, 0 );
+
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t=0; t<nThreads; t++) {
+        int begin, end;
+        int minRowID;
+        row_range( X.rows(), t, nThreads, begin, end );
+        pairwise_distance_rows( X, Mu, Dist, begin, end );
+        for (int nn=begin; nn<end; nn++) {
+            partialDist[t] += Dist.row(nn).minCoeff( &minRowID );
+            Z(nn,0) = minRowID;
+        }
+        // Add back the |x|^2 the product form left out, so the total is
+        // the k-means objective (convergence tests compare it relatively).
+        if (X.cols() > rowwise_dist_max) {
+            for (int nn=begin; nn<end; nn++) {
+                partialDist[t] += X.row(nn).square().sum();
+            }
+        }
+    }
+
     double totalDist = 0;
-    int minRowID;
+    for (int t=0; t<nThreads; t++) {
+        totalDist += partialDist[t];
+    }
+    return totalDist;
+}
+
+template <typename Scalar>
+double assignClosest( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, ExtMatT<Scalar> &Z, MatT<Scalar> &Dist, int nThreads=1 ) {
+    vector<double> partialDist( nThreads, 0 );
+    return assignClosest( X, Mu, Z, Dist, partialDist, nThreads );
+}
+
+/*
+ * Same as assignClosest, through a fixed-dimension kernel.
+ */
+template <typename Scalar>
+double assignClosestFixed( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, ExtMatT<Scalar> &Z, AssignRowsFn<Scalar> kernel, VecT<Scalar> &MuBlocked, vector<double> &partialDist, int nThreads ) {
+    pack_centroids( Mu, MuBlocked );
+    partialDist.assign( nThreads, 0 );
+
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t=0; t<nThreads; t++) {
+        int begin, end;
+        row_range( X.rows(), t, nThreads, begin, end );
+        partialDist[t] = kernel( X.data(), X.rows(), MuBlocked.data(), Mu.rows(), Z.data(), begin, end );
+    }
+
+    double totalDist = 0;
+    for (int t=0; t<nThreads; t++) {
+        totalDist += partialDist[t];
+    }
+    return totalDist;
+}
 
-    pairwise_distance( X, Mu, Dist );
+/*
+ * Same as assignClosest, through a CentroidTree built from Mu.
+ */
+template <typename Scalar>
+double assignClosestTree( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, ExtMatT<Scalar> &Z, CentroidTree<Scalar> &tree, vector<double> &partialDist, int nThreads ) {
+    tree.build( Mu );
+    partialDist.assign( nThreads, 0 );
+    int N = X.rows();
+    int D = X.cols();
 
-    for (int nn=0; nn<X.rows(); nn++) {
-        totalDist += Dist.row(nn).minCoeff( &minRowID );
-        Z(nn,0) = minRowID;
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t=0; t<nThreads; t++) {
+        int begin, end;
+        row_range( N, t, nThreads, begin, end );
+        Scalar x[FixedDimMax];  // the tree takes D up to FixedDimMax
+        for (int nn=begin; nn<end; nn++) {
+            for (int d=0; d<D; d++) {
+                x[d] = X(nn, d);
+            }
+            Scalar best;
+            int bestID;
+            tree.nearest( x, best, bestID );
+            Z(nn,0) = bestID;
+            partialDist[t] += best;
+        }
+    }
+
+    double totalDist = 0;
+    for (int t=0; t<nThreads; t++) {
+        totalDist += partialDist[t];
     }
     return totalDist;
 }
 
 // ======================================================= Update Locations Mu
-void calc_Mu( ExtMat &X, ExtMat &Mu, ExtMat &Z) {
+template <typename Scalar>
+void calc_Mu( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, ExtMatT<Scalar> &Z, KMeansWorkspaceT<Scalar> &ws, int nThreads ) {
+    int K = Mu.rows();
+    vector<MatT<Scalar>> &partialMu = ws.partialMu;
+    vector<VecT<Scalar>> &partialN = ws.partialN;
+
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t=0; t<nThreads; t++) {
+        int begin, end;
+        row_range( X.rows(), t, nThreads, begin, end );
+        partialMu[t].setZero();
+        partialN[t].setZero();
+        for (int nn=begin; nn<end; nn++) {
+            partialMu[t].row((int) Z(nn,0)) += X.row(nn);
+            partialN[t][(int) Z(nn,0)] += 1;
+        }
+    }
+
     //Mu = Mat::Zero(Mu.rows(), Mu.cols());
     Mu.fill(0);
-    Vec NperCluster = Vec::Zero(Mu.rows());
-    for (int nn=0; nn<X.rows(); nn++) {
-        Mu.row((int) Z(nn,0)) += X.row(nn);
-        NperCluster[(int) Z(nn,0)] += 1;
-    }  
-    NperCluster += 1e-100; // avoid division-by-zero
+    VecT<Scalar> &NperCluster = ws.NperCluster;
+    NperCluster.setZero( K );
+    for (int t=0; t<nThreads; t++) {
+        Mu += partialMu[t];
+        NperCluster += partialN[t];
+    }
+    NperCluster += numeric_limits<Scalar>::min(); // avoid division-by-zero
     for (int k=0; k < Mu.rows(); k++) {
        Mu.row(k) /= NperCluster(k);
     }
 }
 
+template <typename Scalar>
+void calc_Mu( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, ExtMatT<Scalar> &Z, int nThreads=1 ) {
+    KMeansWorkspaceT<Scalar> ws;
+    ws.reserve( 0, Mu.rows(), Mu.cols(), nThreads );
+    calc_Mu( X, Mu, Z, ws, nThreads );
+}
+
+/*
+ * Running cluster sums and counts of the Lloyd path, in ws.sumMu and
+ * ws.countMu. With `full`, every point is summed; otherwise only points
+ * whose label differs from ws.Zprev are moved between their old and new
+ * cluster, so a late iteration costs O(moved points * D) instead of
+ * O(N * D). Per-range deltas are reduced in range order. Returns the
+ * number of points that changed label (N when `full`).
+ */
+template <typename Scalar>
+long update_sums( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Z, KMeansWorkspaceT<Scalar> &ws, bool full, int nThreads ) {
+    vector<MatT<Scalar>> &partialMu = ws.partialMu;
+    vector<VecT<Scalar>> &partialN = ws.partialN;
+
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t=0; t<nThreads; t++) {
+        int begin, end;
+        row_range( X.rows(), t, nThreads, begin, end );
+        partialMu[t].setZero();
+        partialN[t].setZero();
+        long moved = 0;
+        for (int nn=begin; nn<end; nn++) {
+            int kk = (int) Z(nn,0);
+            if (!full) {
+                int prev = ws.Zprev(nn);
+                if (prev == kk) {
+                    continue;
+                }
+                partialMu[t].row(prev) -= X.row(nn);
+                partialN[t][prev] -= 1;
+            }
+            partialMu[t].row(kk) += X.row(nn);
+            partialN[t][kk] += 1;
+            ws.Zprev(nn) = kk;
+            moved++;
+        }
+        ws.partialMoved[t] = moved;
+    }
+
+    if (full) {
+        ws.sumMu.setZero();
+        ws.countMu.setZero();
+    }
+    long moved = 0;
+    for (int t=0; t<nThreads; t++) {
+        ws.sumMu += partialMu[t].template cast<double>();
+        ws.countMu += partialN[t].template cast<double>();
+        moved += ws.partialMoved[t];
+    }
+    return moved;
+}
+
+/*
+ * Mu = running sums / counts. An empty cluster gets a zero centroid (as
+ * in calc_Mu), and its sums are cleared of leftover rounding.
+ */
+template <typename Scalar>
+void centroids_from_sums( ExtMatT<Scalar> &Mu, KMeansWorkspaceT<Scalar> &ws ) {
+    for (int kk=0; kk<Mu.rows(); kk++) {
+        if (ws.countMu(kk) > 0) {
+            Mu.row(kk) = ( ws.sumMu.row(kk) / ws.countMu(kk) ).template cast<Scalar>();
+        } else {
+            Mu.row(kk).setZero();
+            ws.sumMu.row(kk).setZero();
+        }
+    }
+}
+
+/*
+ * Sum of squared distances from each row to its assigned centroid.
+ */
+template <typename Scalar>
+double calc_inertia( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, ExtMatT<Scalar> &Z, vector<double> &partial, int nThreads ) {
+    int N = X.rows();
+    partial.assign( nThreads, 0.0 );
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t = 0; t < nThreads; t++) {
+        int begin, end;
+        row_range( N, t, nThreads, begin, end );
+        double sum = 0;
+        for (int nn = begin; nn < end; nn++) {
+            sum += ( X.row(nn) - Mu.row( (int) Z(nn,0) ) ).square().sum();
+        }
+        partial[t] = sum;
+    }
+    return accumulate( partial.begin(), partial.end(), 0.0 );
+}
+
+template <typename Scalar>
+double calc_inertia( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, ExtMatT<Scalar> &Z, int nThreads=1 ) {
+    vector<double> partial( nThreads, 0.0 );
+    return calc_inertia( X, Mu, Z, partial, nThreads );
+}
+
 // ======================================================= Overall Lloyd Alg.
-void run_lloyd( ExtMat &X, ExtMat &Mu, ExtMat &Z, int Niter )  {
-    double prevDist,totalDist = 0;
-    Mat Dist = Mat::Zero( X.rows(), Mu.rows() );  
+/*
+ * Returns the number of iterations run; fewer than Niter means the run
+ * converged: no more than movedFraction * N points changed label, or the
+ * objective changed by no more than tol relative to the previous one.
+ * With both at 0 that is an exact fixed point. Centroids are updated
+ * from running sums (update_sums), touching only the moved points.
+ */
+template <typename Scalar>
+int run_lloyd( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, ExtMatT<Scalar> &Z, int Niter, KMeansWorkspaceT<Scalar> &ws, int nThreads, double tol=0, double movedFraction=0 )  {
+    double prevDist = numeric_limits<double>::infinity();
+    double totalDist = 0;
+    MatT<Scalar> &Dist = ws.Dist;
+    AssignRowsFn<Scalar> kernel = fixed_dim_kernel<Scalar>( X.cols() );
+    bool useTree = use_centroid_tree( Mu.rows(), X.cols() );
+    PROFILE_LLOYD_TRACE( trace, Z );
 
-    for (int iter=0; iter<Niter; iter++) {
-        totalDist = assignClosest( X, Mu, Z, Dist );
-        calc_Mu( X, Mu, Z );
-        if (prevDist == totalDist) {
+    int iter;
+    bool converged = false;
+    for (iter=0; iter<Niter; iter++) {
+        if (useTree) {
+            totalDist = assignClosestTree( X, Mu, Z, ws.tree, ws.partialDist, nThreads );
+        } else if (kernel != nullptr) {
+            totalDist = assignClosestFixed( X, Mu, Z, kernel, ws.MuBlocked, ws.partialDist, nThreads );
+        } else {
+            totalDist = assignClosest( X, Mu, Z, Dist, ws.partialDist, nThreads );
+        }
+        long moved = update_sums( X, Z, ws, iter == 0, nThreads );
+        centroids_from_sums( Mu, ws );
+        PROFILE_LLOYD_ITERATION( trace, iter, totalDist, Z );
+        converged = iter > 0 && ( moved <= movedFraction * X.rows() || fabs( prevDist - totalDist ) <= tol * prevDist );
+        if (converged) {
             break;
         }
         prevDist = totalDist;
     }
+    PROFILE_LLOYD_DONE( trace, converged );
+    return min( iter + 1, Niter );
+}
+
+template <typename Scalar>
+int run_lloyd( ExtMatT<Scalar> &X, ExtMatT<Scalar> &Mu, ExtMatT<Scalar> &Z, int Niter, int nThreads=1, double tol=0, double movedFraction=0 )  {
+    KMeansWorkspaceT<Scalar> ws;
+    ws.reserve( X.rows(), Mu.rows(), Mu.cols(), nThreads );
+    return run_lloyd( X, Mu, Z, Niter, ws, nThreads, tol, movedFraction );
+}
+
+// ======================================================= Bounded Lloyd Alg.
+/*
+ * Euclidean (not squared) distance between row nn of X and row kk of Mu.
+ */
+double row_dist( RowMat &X, int nn, RowMat &Mu, int kk ) {
+    double dist = 0;
+    for (int dd=0; dd<X.cols(); dd++) {
+        double diff = X(nn,dd) - Mu(kk,dd);
+        dist += diff*diff;
+    }
+    return sqrt(dist);
+}
+
+/*
+ * CC(k,j) = |mu_k - mu_j|,  S(k) = min_{j != k} CC(k,j) / 2.
+ */
+void center_distances( RowMat &Mu, Mat &CC, Vec &S ) {
+    int K = Mu.rows();
+    S.fill( numeric_limits<double>::infinity() );
+    for (int kk=0; kk<K; kk++) {
+        CC(kk,kk) = 0;
+        for (int jj=kk+1; jj<K; jj++) {
+            CC(kk,jj) = CC(jj,kk) = sqrt((Mu.row(kk) - Mu.row(jj)).square().sum());
+            S(kk) = min( S(kk), CC(kk,jj) / 2 );
+            S(jj) = min( S(jj), CC(kk,jj) / 2 );
+        }
+    }
+}
+
+/*
+ * Recompute Mu from Z and record how far each centroid moved.
+ */
+void update_centers( ExtMat &X, ExtMat &Mu, ExtMat &Z, RowMat &MuRows, Vec &drift, int nThreads ) {
+    calc_Mu( X, Mu, Z, nThreads );
+    for (int kk=0; kk<Mu.rows(); kk++) {
+        drift(kk) = sqrt((MuRows.row(kk) - Mu.row(kk)).square().sum());
+    }
+    MuRows = Mu;
+}
+
+/*
+ * Closest and second closest centroid of row nn, by full scan.
+ */
+void scan_closest( RowMat &X, int nn, RowMat &Mu, int &best, double &bestDist, double &secondDist ) {
+    best = 0;
+    bestDist = secondDist = numeric_limits<double>::infinity();
+    for (int kk=0; kk<Mu.rows(); kk++) {
+        double dist = row_dist( X, nn, Mu, kk );
+        if (dist < bestDist) {
+            secondDist = bestDist;
+            bestDist = dist;
+            best = kk;
+        } else if (dist < secondDist) {
+            secondDist = dist;
+        }
+    }
+}
+
+void run_hamerly( ExtMat &X, ExtMat &Mu, ExtMat &Z, int Niter, int nThreads=1 ) {
+    int N = X.rows();
+    int K = Mu.rows();
+    RowMat XRows = X;
+    RowMat MuRows = Mu;
+    Vec upper(N), lower(N), S(K), drift(K);
+    Mat CC(K, K);
+    vector<int> nChanged( nThreads );
+
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t=0; t<nThreads; t++) {
+        int begin, end, best;
+        row_range( N, t, nThreads, begin, end );
+        for (int nn=begin; nn<end; nn++) {
+            scan_closest( XRows, nn, MuRows, best, upper(nn), lower(nn) );
+            Z(nn,0) = best;
+        }
+    }
+
+    for (int iter=1; iter<Niter; iter++) {
+        update_centers( X, Mu, Z, MuRows, drift, nThreads );
+
+        // Largest and second largest drift, for the lower bounds.
+        int maxID;
+        double maxDrift = drift.maxCoeff( &maxID );
+        double secondDrift = 0;
+        for (int kk=0; kk<K; kk++) {
+            if (kk != maxID) secondDrift = max( secondDrift, drift(kk) );
+        }
+        center_distances( MuRows, CC, S );
+
+        #pragma omp parallel for schedule(static) num_threads(nThreads)
+        for (int t=0; t<nThreads; t++) {
+            int begin, end, best;
+            row_range( N, t, nThreads, begin, end );
+            nChanged[t] = 0;
+            for (int nn=begin; nn<end; nn++) {
+                int a = (int) Z(nn,0);
+                upper(nn) += drift(a);
+                lower(nn) -= (a == maxID) ? secondDrift : maxDrift;
+
+                double bound = max( S(a), lower(nn) );
+                if (upper(nn) <= bound) continue;
+                upper(nn) = row_dist( XRows, nn, MuRows, a );
+                if (upper(nn) <= bound) continue;
+
+                scan_closest( XRows, nn, MuRows, best, upper(nn), lower(nn) );
+                if (best != a) {
+                    Z(nn,0) = best;
+                    nChanged[t]++;
+                }
+            }
+        }
+
+        int changed = 0;
+        for (int t=0; t<nThreads; t++) changed += nChanged[t];
+        if (changed == 0) {
+            return;
+        }
+    }
+    calc_Mu( X, Mu, Z, nThreads );
+}
+
+void run_elkan( ExtMat &X, ExtMat &Mu, ExtMat &Z, int Niter, int nThreads=1 ) {
+    int N = X.rows();
+    int K = Mu.rows();
+    RowMat XRows = X;
+    RowMat MuRows = Mu;
+    RowMat lower(N, K);
+    Vec upper(N), S(K), drift(K);
+    Mat CC(K, K);
+    vector<int> nChanged( nThreads );
+
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t=0; t<nThreads; t++) {
+        int begin, end, best;
+        row_range( N, t, nThreads, begin, end );
+        for (int nn=begin; nn<end; nn++) {
+            best = 0;
+            for (int kk=0; kk<K; kk++) {
+                lower(nn,kk) = row_dist( XRows, nn, MuRows, kk );
+                if (lower(nn,kk) < lower(nn,best)) best = kk;
+            }
+            upper(nn) = lower(nn,best);
+            Z(nn,0) = best;
+        }
+    }
+
+    for (int iter=1; iter<Niter; iter++) {
+        update_centers( X, Mu, Z, MuRows, drift, nThreads );
+        center_distances( MuRows, CC, S );
+
+        #pragma omp parallel for schedule(static) num_threads(nThreads)
+        for (int t=0; t<nThreads; t++) {
+            int begin, end;
+            row_range( N, t, nThreads, begin, end );
+            nChanged[t] = 0;
+            for (int nn=begin; nn<end; nn++) {
+                int a = (int) Z(nn,0);
+                lower.row(nn) = (lower.row(nn) - drift.transpose()).max( 0 );
+                upper(nn) += drift(a);
+                if (upper(nn) <= S(a)) continue;
+
+                bool tight = false;
+                int best = a;
+                for (int kk=0; kk<K; kk++) {
+                    if (kk == best || upper(nn) <= lower(nn,kk) || upper(nn) <= CC(best,kk) / 2) continue;
+                    if (!tight) {
+                        upper(nn) = lower(nn,best) = row_dist( XRows, nn, MuRows, best );
+                        tight = true;
+                        if (upper(nn) <= lower(nn,kk) || upper(nn) <= CC(best,kk) / 2) continue;
+                    }
+                    lower(nn,kk) = row_dist( XRows, nn, MuRows, kk );
+                    if (lower(nn,kk) < upper(nn)) {
+                        best = kk;
+                        upper(nn) = lower(nn,kk);
+                    }
+                }
+                if (best != a) {
+                    Z(nn,0) = best;
+                    nChanged[t]++;
+                }
+            }
+        }
+
+        int changed = 0;
+        for (int t=0; t<nThreads; t++) changed += nChanged[t];
+        if (changed == 0) {
+            return;
+        }
+    }
+    calc_Mu( X, Mu, Z, nThreads );
+}
+
+// ======================================================= Mini-batch Alg.
+/*
+ * Assign every row to its closest centroid without an N x K distance
+ * matrix: each range streams through blocks of blockRows rows.
+ */
+double assignClosestBlocked( ExtMat &X, ExtMat &Mu, ExtMat &Z, int blockRows, int nThreads=1 ) {
+    vector<double> partialDist( nThreads, 0 );
+
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t=0; t<nThreads; t++) {
+        int begin, end;
+        int minRowID;
+        row_range( X.rows(), t, nThreads, begin, end );
+        Mat Dist( blockRows, Mu.rows() );
+        for (int blockBegin=begin; blockBegin<end; blockBegin+=blockRows) {
+            int blockEnd = min( blockBegin + blockRows, end );
+            pairwise_distance_rows( X, Mu, Dist, blockBegin, blockEnd, 0 );
+            for (int nn=blockBegin; nn<blockEnd; nn++) {
+                partialDist[t] += Dist.row(nn - blockBegin).minCoeff( &minRowID );
+                Z(nn,0) = minRowID;
+            }
+        }
+    }
+
+    double totalDist = 0;
+    for (int t=0; t<nThreads; t++) {
+        totalDist += partialDist[t];
+    }
+    return totalDist;
+}
+
+/*
+ * Mini-batch k-means (Sculley 2010). Each of Niter steps draws batchSize
+ * rows, assigns them to the current centroids, and moves each centroid
+ * towards its new members with learning rate 1 / (points seen so far).
+ * A final blocked pass assigns all rows.
+ */
+void run_minibatch( ExtMat &X, ExtMat &Mu, ExtMat &Z, int Niter, int batchSize, mt_state &rng, int nThreads=1 ) {
+    int N = X.rows();
+    int D = X.cols();
+    int K = Mu.rows();
+    batchSize = max( 1, min(batchSize, N) );
+
+    Mat Batch( batchSize, D );
+    Mat Dist( batchSize, K );
+    Vec BatchZ( batchSize );
+    Vec NperCluster = Vec::Zero(K);
+    ExtMat BatchMap( Batch.data(), batchSize, D );
+    ExtMat BatchZMap( BatchZ.data(), batchSize, 1 );
+
+    for (int iter=0; iter<Niter; iter++) {
+        for (int bb=0; bb<batchSize; bb++) {
+            Batch.row(bb) = X.row( randint(0, N, rng) );
+        }
+        assignClosest( BatchMap, Mu, BatchZMap, Dist, nThreads );
+
+        for (int bb=0; bb<batchSize; bb++) {
+            int kk = (int) BatchZ(bb);
+            NperCluster(kk) += 1;
+            double eta = 1.0 / NperCluster(kk);
+            Mu.row(kk) = (1 - eta) * Mu.row(kk) + eta * Batch.row(bb);
+        }
+    }
+
+    assignClosestBlocked( X, Mu, Z, 4096, nThreads );
+}
+
+// ======================================================= Scalable Init (k-means||)
+/*
+ * For each row n, if some row of C is closer than minDist(n), set
+ * minDist(n) to that squared distance and closest[n] to firstID + its
+ * index. Streams X in blocks using the matrix-product distance form.
+ */
+void update_min_dist( ExtMat &X, ExtMat &C, Vec &minDist, vector<int> &closest, int firstID, int nThreads ) {
+    int blockRows = 256;
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (int t=0; t<nThreads; t++) {
+        int begin, end;
+        row_range( X.rows(), t, nThreads, begin, end );
+        Mat Dist( blockRows, C.rows() );
+        Vec best( blockRows );
+        ArrayXi bestID( blockRows );
+        for (int blockBegin=begin; blockBegin<end; blockBegin+=blockRows) {
+            int blockEnd = min( blockBegin + blockRows, end );
+            int n = blockEnd - blockBegin;
+            pairwise_distance_rows( X, C, Dist, blockBegin, blockEnd, 0, true );
+            // Sweep columns (contiguous in Dist) rather than rows.
+            best.head(n) = Dist.col(0).head(n);
+            bestID.head(n).fill(0);
+            for (int cc=1; cc<C.rows(); cc++) {
+                for (int ii=0; ii<n; ii++) {
+                    if (Dist(ii,cc) < best(ii)) {
+                        best(ii) = Dist(ii,cc);
+                        bestID(ii) = cc;
+                    }
+                }
+            }
+            best.head(n) = (best.head(n) + X.middleRows(blockBegin, n).square().rowwise().sum()).max(0);
+            for (int ii=0; ii<n; ii++) {
+                if (best(ii) < minDist(blockBegin + ii)) {
+                    minDist(blockBegin + ii) = best(ii);
+                    closest[blockBegin + ii] = firstID + bestID(ii);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * kmeans++ over weighted points C, followed by a few weighted Lloyd steps.
+ */
+void weightedPlusPlus( Mat &C, Vec &weights, ExtMat &Mu, int Niter, mt_state &rng ) {
+    int nC = C.rows();
+    int K = Mu.rows();
+    Vec minDist = Vec::Constant( nC, numeric_limits<double>::infinity() );
+    Mu.row(0) = C.row( DiscreteSampler( weights ).draw( rng ) );
+    for (int kk=1; kk<K; kk++) {
+        minDist = minDist.min( (C.rowwise() - Mu.row(kk-1)).square().rowwise().sum() );
+        Vec p = weights * minDist;
+        Mu.row(kk) = C.row( DiscreteSampler( p ).draw( rng ) );
+    }
+
+    Mat Sum( K, C.cols() );
+    Vec Weight( K );
+    int minRowID;
+    for (int iter=0; iter<Niter; iter++) {
+        Sum.fill(0);
+        Weight.fill(0);
+        for (int cc=0; cc<nC; cc++) {
+            (Mu.rowwise() - C.row(cc)).square().rowwise().sum().minCoeff( &minRowID );
+            Sum.row(minRowID) += weights(cc) * C.row(cc);
+            Weight(minRowID) += weights(cc);
+        }
+        for (int kk=0; kk<K; kk++) {
+            if (Weight(kk) > 0) Mu.row(kk) = Sum.row(kk) / Weight(kk);
+        }
+    }
+}
+
+/*
+ * k-means|| initialization (Bahmani et al. 2012). Instead of K sequential
+ * passes over X, run nRounds passes that each keep every row independently
+ * with probability min(1, oversample * K * minDist / sum(minDist)). The
+ * candidates are weighted by how many rows they are closest to and
+ * reclustered down to K centroids with weighted kmeans++.
+ */
+void sampleRowsScalable( ExtMat &X, ExtMat &Mu, mt_state &rng, int nThreads=1, int nRounds=4, double oversample=1.0 ) {
+    int N = X.rows();
+    int D = X.cols();
+    int K = Mu.rows();
+    double ell = oversample * K;
+
+    vector<int> candidates( 1, randint(0, N, rng) );
+    vector<int> closest( N, 0 );
+    Vec minDist = Vec::Constant( N, numeric_limits<double>::infinity() );
+    Mat First = X.row( candidates[0] );
+    ExtMat FirstMap( First.data(), 1, D );
+    update_min_dist( X, FirstMap, minDist, closest, 0, nThreads );
+
+    vector< vector<int> > picked( nThreads );
+    for (int round=0; round<nRounds; round++) {
+        double phi = minDist.sum();
+        if (phi <= 0) break;
+        unsigned long long roundKey = ((unsigned long long) genrand_int32_r( &rng ) << 32) | genrand_int32_r( &rng );
+
+        #pragma omp parallel for schedule(static) num_threads(nThreads)
+        for (int t=0; t<nThreads; t++) {
+            int begin, end;
+            row_range( N, t, nThreads, begin, end );
+            picked[t].clear();
+            for (int nn=begin; nn<end; nn++) {
+                if (hash_uniform( roundKey + (unsigned long long) nn * 0x9e3779b97f4a7c15ULL ) * phi < ell * minDist(nn)) {
+                    picked[t].push_back( nn );
+                }
+            }
+        }
+
+        int firstNew = candidates.size();
+        for (int t=0; t<nThreads; t++) {
+            candidates.insert( candidates.end(), picked[t].begin(), picked[t].end() );
+        }
+        int nNew = candidates.size() - firstNew;
+        if (nNew == 0) continue;
+        Mat New( nNew, D );
+        for (int cc=0; cc<nNew; cc++) {
+            New.row(cc) = X.row( candidates[firstNew + cc] );
+        }
+        ExtMat NewMap( New.data(), nNew, D );
+        update_min_dist( X, NewMap, minDist, closest, firstNew, nThreads );
+    }
+
+    // Weight each candidate by the number of rows closest to it.
+    int nC = candidates.size();
+    Mat C( nC, D );
+    for (int cc=0; cc<nC; cc++) {
+        C.row(cc) = X.row( candidates[cc] );
+    }
+    Vec weights = Vec::Zero( nC );
+    for (int nn=0; nn<N; nn++) {
+        weights( closest[nn] ) += 1;
+    }
+
+    if (nC <= K) {
+        // Too few candidates: take them all, fill up with random rows.
+        for (int kk=0; kk<K; kk++) {
+            if (kk < nC) Mu.row(kk) = C.row(kk);
+            else Mu.row(kk) = X.row( randint(0, N, rng) );
+        }
+        return;
+    }
+    weightedPlusPlus( C, weights, Mu, 10, rng );
+}
+
+void init_Mu( ExtMat &X, ExtMat &Mu, const char* initname, mt_state &rng, int nThreads=1 ) {		  
+    PROFILE_STAGE( "kmeans_init" );
+    if (string(initname) == "random") {
+        sampleRowsRandom( X, Mu, rng );
+    } else if (string(initname) == "plusplus") {
+        sampleRowsPlusPlus( X, Mu, rng );
+    } else if (string(initname) == "sampled") {
+        sampleRowsPlusPlusSubset( X, Mu, max(10000, 20 * (int) Mu.rows()), rng );
+    } else if (string(initname) == "scalable") {
+        sampleRowsScalable( X, Mu, rng, nThreads );
+    }
+}
+
+void run_kmeans( ExtMat &X, ExtMat &Mu, ExtMat &Z, int Niter, const char* algname, mt_state &rng, int nThreads=1, int batchSize=1024, double tol=0, double movedFraction=0 ) {
+    PROFILE_STAGE( "kmeans_iterations" );
+    if (string(algname) == "minibatch") {
+        run_minibatch( X, Mu, Z, Niter, batchSize, rng, nThreads );
+    } else if (string(algname) == "hamerly") {
+        run_hamerly( X, Mu, Z, Niter, nThreads );
+    } else if (string(algname) == "elkan") {
+        run_elkan( X, Mu, Z, Niter, nThreads );
+    } else {
+        run_lloyd( X, Mu, Z, Niter, nThreads, tol, movedFraction );
+    }
 }
 
 // ===========================================================================
@@ -214,24 +1332,85 @@ void run_lloyd( ExtMat &X, ExtMat &Mu, ExtMat &Z, int Niter )  {
 // ===========================================================================
 
 void RunKMeans(double *X_IN,  int N,  int D, int K, int Niter, \
-               int seed, char* initname, double *Mu_OUT, double *Z_OUT) {
-  set_seed(seed);
+               int seed, const char* initname, double *Mu_OUT, double *Z_OUT, \
+               int nThreads=1, const char* algname="lloyd", int batchSize=1024, \
+               double tol=0, double movedFraction=0) {
+  mt_state rng;
+  init_genrand_r( &rng, seed );
 
   ExtMat X (X_IN, N, D);
   ExtMat Mu (Mu_OUT, K, D);
   ExtMat Z (Z_OUT, N, 1);
 
-  init_Mu(X, Mu, initname);
-  run_lloyd(X, Mu, Z, Niter );
+  init_Mu(X, Mu, initname, rng, nThreads);
+  run_kmeans(X, Mu, Z, Niter, algname, rng, nThreads, batchSize, tol, movedFraction );
+}
+
+
+/*
+ * nInit independent restarts (init + run_kmeans), each with its own
+ * generator seeded by restart_seed( seed, r ). Keeps the restart with the
+ * lowest inertia, ties going to the lower restart index, and returns it.
+ * Restarts run concurrently with one thread each; a single restart uses
+ * all nThreads inside its assignment/update steps instead.
+ */
+double RunKMeansMultiRestart(double *X_IN,  int N,  int D, int K, int Niter, \
+               int seed, const char* initname, double *Mu_OUT, double *Z_OUT, \
+               int nInit=1, int nThreads=1, const char* algname="lloyd", int batchSize=1024, \
+               double tol=0, double movedFraction=0) {
+  ExtMat X (X_IN, N, D);
+  ExtMat MuBest (Mu_OUT, K, D);
+  ExtMat ZBest (Z_OUT, N, 1);
+  nInit = max( nInit, 1 );
+  int nWorkers = min( nInit, nThreads );
+  int innerThreads = (nInit == 1) ? nThreads : 1;
+
+  // One Mu/Z buffer per worker; each keeps its own best restart.
+  vector<Mat> MuWork( nWorkers, Mat(K, D) );
+  vector<Mat> ZWork( nWorkers, Mat(N, 1) );
+  vector<Mat> MuKeep( nWorkers );
+  vector<Mat> ZKeep( nWorkers );
+  vector<double> bestInertia( nWorkers, numeric_limits<double>::infinity() );
+  vector<int> bestRestart( nWorkers, -1 );
+
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(nWorkers)
+  for (int r = 0; r < nInit; r++) {
+    int w = nWorkers > 1 ? ThreadIndex() : 0;
+    mt_state rng;
+    init_genrand_r( &rng, restart_seed( seed, r ) );
+    ExtMat Mu (MuWork[w].data(), K, D);
+    ExtMat Z (ZWork[w].data(), N, 1);
+    init_Mu( X, Mu, initname, rng, innerThreads );
+    run_kmeans( X, Mu, Z, Niter, algname, rng, innerThreads, batchSize, tol, movedFraction );
+    double inertia = calc_inertia( X, Mu, Z, innerThreads );
+    if (inertia < bestInertia[w] || (inertia == bestInertia[w] && r < bestRestart[w])) {
+      bestInertia[w] = inertia;
+      bestRestart[w] = r;
+      MuKeep[w] = MuWork[w];
+      ZKeep[w] = ZWork[w];
+    }
+  }
+
+  int best = 0;
+  for (int w = 1; w < nWorkers; w++) {
+    if (bestInertia[w] < bestInertia[best] ||
+        (bestInertia[w] == bestInertia[best] && bestRestart[w] < bestRestart[best])) {
+      best = w;
+    }
+  }
+  MuBest = MuKeep[best];
+  ZBest = ZKeep[best];
+  return bestInertia[best];
 }
 
 
 void SampleRowsPlusPlus(double *X_IN,  int N,  int D, int K, \
                         int seed, double *Mu_OUT) {
-  set_seed(seed);
+  mt_state rng;
+  init_genrand_r( &rng, seed );
 
   ExtMat X (X_IN, N, D);
   ExtMat Mu (Mu_OUT, K, D);
 
-  sampleRowsPlusPlus(X, Mu);
+  sampleRowsPlusPlus(X, Mu, rng);
 }
@@ -50,12 +50,21 @@
 #define UPPER_MASK 0x80000000UL /* most significant w-r bits */
 #define LOWER_MASK 0x7fffffffUL /* least significant r bits */
 
-static unsigned long mt[N_N]; /* the array for the state vector  */
-static int mti=N_N+1; /* mti==N_N+1 means mt[N_N] is not initialized */
-
-/* initializes mt[N_N] with a seed */
-void init_genrand(unsigned long s)
+/* Generator state. Each independent stream (e.g. one k-means run) owns
+   one, so streams can be used from different threads at the same time.
+   The functions without the _r suffix use the shared default_mt_state. */
+typedef struct mt_state {
+    unsigned long mt[N_N]; /* the array for the state vector  */
+    int mti; /* mti==N_N+1 means mt[N_N] is not initialized */
+} mt_state;
+
+static mt_state default_mt_state = { {0}, N_N+1 };
+
+/* initializes state->mt[N_N] with a seed */
+void init_genrand_r(mt_state *state, unsigned long s)
 {
+    unsigned long *mt = state->mt;
+    int mti;
     mt[0]= s & 0xffffffffUL;
     for (mti=1; mti<N_N; mti++) {
         mt[mti] = 
@@ -67,6 +76,13 @@ void init_genrand(unsigned long s)
         mt[mti] &= 0xffffffffUL;
         /* for >32 bit machines */
     }
+    state->mti = mti;
+}
+
+/* initializes mt[N_N] with a seed */
+void init_genrand(unsigned long s)
+{
+    init_genrand_r(&default_mt_state, s);
 }
 
 /* initialize by an array with array-length */
@@ -75,6 +91,7 @@ void init_genrand(unsigned long s)
 /* slight change for C++, 2004/2/26 */
 void init_by_array(unsigned long init_key[], int key_length)
 {
+    unsigned long *mt = default_mt_state.mt;
     int i, j, k;
     init_genrand(19650218UL);
     i=1; j=0;
@@ -99,17 +116,18 @@ void init_by_array(unsigned long init_key[], int key_length)
 }
 
 /* generates a random number on [0,0xffffffff]-interval */
-unsigned long genrand_int32(void)
+unsigned long genrand_int32_r(mt_state *state)
 {
+    unsigned long *mt = state->mt;
     unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
+    static const unsigned long mag01[2]={0x0UL, MATRIX_A};
     /* mag01[x] = x * MATRIX_A  for x=0,1 */
 
-    if (mti >= N_N) { /* generate N_N words at one time */
+    if (state->mti >= N_N) { /* generate N_N words at one time */
         int kk;
 
-        if (mti == N_N+1)   /* if init_genrand() has not been called, */
-            init_genrand(5489UL); /* a default initial seed is used */
+        if (state->mti == N_N+1)   /* if init_genrand() has not been called, */
+            init_genrand_r(state, 5489UL); /* a default initial seed is used */
 
         for (kk=0;kk<N_N-M_M;kk++) {
             y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
@@ -122,10 +140,10 @@ unsigned long genrand_int32(void)
         y = (mt[N_N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
         mt[N_N-1] = mt[M_M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
 
-        mti = 0;
+        state->mti = 0;
     }
   
-    y = mt[mti++];
+    y = mt[state->mti++];
 
     /* Tempering */
     y ^= (y >> 11);
@@ -136,6 +154,11 @@ unsigned long genrand_int32(void)
     return y;
 }
 
+unsigned long genrand_int32(void)
+{
+    return genrand_int32_r(&default_mt_state);
+}
+
 /*  =====================================================================
 Generates double in interval [0,1]
 
@@ -144,42 +167,18 @@ Note: the last five functions call the first one.
 if you need more speed for these five functions, you may
 suppress the function call by copying genrand_int32() and
 replacing the last return(), following to these five functions.
+(The copy that used to live here is now a call: the state is no longer
+file-level, and the compiler inlines genrand_int32_r anyway.)
  *  =====================================================================
  */
-double genrand_double(void)
+double genrand_double_r(mt_state *state)
 {
-    unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
-    /* mag01[x] = x * MATRIX_A  for x=0,1 */
-
-    if (mti >= N_N) { /* generate N_N words at one time */
-        int kk;
-
-        if (mti == N_N+1)   /* if init_genrand() has not been called, */
-            init_genrand(5489UL); /* a default initial seed is used */
-
-        for (kk=0;kk<N_N-M_M;kk++) {
-            y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-            mt[kk] = mt[kk+M_M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        for (;kk<N_N-1;kk++) {
-            y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-            mt[kk] = mt[kk+(M_M-N_N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        y = (mt[N_N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
-        mt[N_N-1] = mt[M_M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
-
-        mti = 0;
-    }
-  
-    y = mt[mti++];
+    return genrand_int32_r(state)*(1.0/4294967295.0); 
+}
 
-    /* Tempering */
-    y ^= (y >> 11);
-    y ^= (y << 7) & 0x9d2c5680UL;
-    y ^= (y << 15) & 0xefc60000UL;
-    y ^= (y >> 18);
-    return y*(1.0/4294967295.0); 
+double genrand_double(void)
+{
+    return genrand_double_r(&default_mt_state);
 }
 
 
@@ -0,0 +1,222 @@
+/* adjacency_matrix.h
+Storage for the adjacency matrix fed to spectral co-clustering.
+
+Document-term style inputs are overwhelmingly zero, so the matrix is
+kept as CSR (nonzeros only) unless its measured density is above a
+threshold, in which case it is stored as a dense Eigen::MatrixXd. All
+sums and the D_r^{-1/2} A D_c^{-1/2} scaling of the sparse form touch the
+stored nonzeros only.
+
+The storage is either owned (`dense` / `sparse`, filled by the readers)
+or a view into a memory-mapped binary cache. Dense() and Sparse() return
+Eigen::Map views over whichever one is live, so the rest of the pipeline
+never copies a cached matrix.
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Eigen/Dense"
+#include "Eigen/Sparse"
+#include "mapped_file.h"
+
+typedef Eigen::SparseMatrix<double, Eigen::RowMajor> CsrMatrix;
+typedef Eigen::Map<Eigen::MatrixXd> DenseView;
+typedef Eigen::Map<CsrMatrix> CsrView;
+template <typename Scalar> using CsrViewT = Eigen::Map<Eigen::SparseMatrix<Scalar, Eigen::RowMajor>>;
+
+/*
+Density below which the sparse representation is kept.
+*/
+const double DefaultSparseThreshold = 0.1;
+
+/*
+Raw arrays of a matrix that lives in a memory mapping.
+*/
+struct MappedArrays
+{
+    Eigen::Index rows = 0;
+    Eigen::Index cols = 0;
+    Eigen::Index nonZeros = 0;
+    double *values = nullptr;  // column-major when dense
+    int *outer = nullptr;      // CSR only
+    int *inner = nullptr;      // CSR only
+};
+
+struct AdjacencyMatrix
+{
+    bool isSparse = false;
+    Eigen::MatrixXd dense;  // owned, used when !isSparse
+    CsrMatrix sparse;       // owned, used when isSparse
+    std::vector<std::string> rowLabels;
+    std::vector<std::string> columnLabels;
+
+    // Raw row/column sums; empty until computed or loaded from a cache.
+    Eigen::VectorXd rowSums;
+    Eigen::VectorXd colSums;
+
+    // Set once a fit has scaled the values in place (they hold An now).
+    bool scaled = false;
+
+    // Set when the matrix is a view into a binary cache.
+    std::shared_ptr<MappedFile> mapping;
+    MappedArrays mapped;
+
+    bool IsMapped() const { return mapping != nullptr; }
+
+    Eigen::Index rows() const
+    {
+        return IsMapped() ? mapped.rows : isSparse ? sparse.rows() : dense.rows();
+    }
+
+    Eigen::Index cols() const
+    {
+        return IsMapped() ? mapped.cols : isSparse ? sparse.cols() : dense.cols();
+    }
+
+    DenseView Dense()
+    {
+        if (IsMapped())
+        {
+            return DenseView(mapped.values, mapped.rows, mapped.cols);
+        }
+        return DenseView(dense.data(), dense.rows(), dense.cols());
+    }
+
+    CsrView Sparse()
+    {
+        if (IsMapped())
+        {
+            return CsrView(mapped.rows, mapped.cols, mapped.nonZeros, mapped.outer, mapped.inner, mapped.values);
+        }
+        return CsrView(sparse.rows(), sparse.cols(), sparse.nonZeros(),
+                       sparse.outerIndexPtr(), sparse.innerIndexPtr(), sparse.valuePtr());
+    }
+};
+
+/*
+Bytes of heap held by the values and indices of `matrix`; 0 when it is
+mapped from a cache, whose pages the kernel can drop and re-read.
+*/
+inline size_t StorageBytes(const AdjacencyMatrix &matrix)
+{
+    if (matrix.IsMapped())
+    {
+        return 0;
+    }
+    if (matrix.isSparse)
+    {
+        return (size_t) matrix.sparse.nonZeros() * (sizeof(double) + sizeof(int))
+            + (size_t) (matrix.sparse.rows() + 1) * sizeof(int);
+    }
+    return (size_t) matrix.dense.size() * sizeof(double);
+}
+
+/*
+Fraction of entries that are nonzero.
+*/
+inline double Density(Eigen::Index nonZeros, Eigen::Index rows, Eigen::Index cols)
+{
+    if (rows == 0 || cols == 0)
+    {
+        return 0.0;
+    }
+    return (double) nonZeros / ((double) rows * (double) cols);
+}
+
+/*
+Switch `matrix` to the representation its measured density calls for:
+CSR below `sparseThreshold`, dense at or above it.
+*/
+inline void ApplySparseThreshold(AdjacencyMatrix &matrix, Eigen::Index nonZeros, double sparseThreshold)
+{
+    bool wantSparse = Density(nonZeros, matrix.rows(), matrix.cols()) < sparseThreshold;
+    if (wantSparse && !matrix.isSparse)
+    {
+        matrix.sparse = matrix.dense.sparseView();
+        matrix.dense.resize(0, 0);
+    }
+    else if (!wantSparse && matrix.isSparse)
+    {
+        matrix.dense = Eigen::MatrixXd(matrix.sparse);
+        matrix.sparse = CsrMatrix();
+    }
+    matrix.isSparse = wantSparse;
+}
+
+/*
+Row and column sums of a CSR matrix, one pass over the nonzeros.
+*/
+inline void SparseSums(const CsrView &matrix, Eigen::VectorXd &rowSums, Eigen::VectorXd &colSums)
+{
+    rowSums = Eigen::VectorXd::Zero(matrix.rows());
+    colSums = Eigen::VectorXd::Zero(matrix.cols());
+
+    const int *outer = matrix.outerIndexPtr();
+    const int *inner = matrix.innerIndexPtr();
+    const double *values = matrix.valuePtr();
+    for (Eigen::Index i = 0; i < matrix.rows(); i++)
+    {
+        double sum = 0.0;
+        for (int p = outer[i]; p < outer[i + 1]; p++)
+        {
+            sum += values[p];
+            colSums(inner[p]) += values[p];
+        }
+        rowSums(i) = sum;
+    }
+}
+
+/*
+Write the nonzeros of diag(rowScale) * A * diag(colScale) to `scaled`, in
+A's storage order and rounded to Scalar. `scaled` may be A's own value
+array.
+*/
+template <typename Scalar>
+void ScaleValues(const CsrView &matrix, const Eigen::VectorXd &rowScale, const Eigen::VectorXd &colScale,
+                 Scalar *scaled)
+{
+    const int *outer = matrix.outerIndexPtr();
+    const int *inner = matrix.innerIndexPtr();
+    const double *values = matrix.valuePtr();
+    for (Eigen::Index i = 0; i < matrix.rows(); i++)
+    {
+        double r = rowScale(i);
+        for (int p = outer[i]; p < outer[i + 1]; p++)
+        {
+            scaled[p] = (Scalar) (values[p] * (r * colScale(inner[p])));
+        }
+    }
+}
+
+/*
+Replace A by diag(rowScale) * A * diag(colScale), touching nonzeros only.
+*/
+inline void ScaleInPlace(CsrView matrix, const Eigen::VectorXd &rowScale, const Eigen::VectorXd &colScale)
+{
+    ScaleValues(matrix, rowScale, colScale, matrix.valuePtr());
+}
+
+/*
+Fill `rowSums` / `colSums` unless they were already loaded.
+*/
+inline void ComputeSums(AdjacencyMatrix &matrix)
+{
+    if (matrix.rowSums.size() == matrix.rows() && matrix.colSums.size() == matrix.cols())
+    {
+        return;
+    }
+    if (matrix.isSparse)
+    {
+        SparseSums(matrix.Sparse(), matrix.rowSums, matrix.colSums);
+    }
+    else
+    {
+        DenseView dense = matrix.Dense();
+        matrix.rowSums = dense.rowwise().sum();
+        matrix.colSums = dense.colwise().sum().transpose();
+    }
+}
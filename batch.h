@@ -0,0 +1,212 @@
+/* batch.h
+Co-cluster many small matrices in one process.
+
+A manifest lists one job per line:
+    <input> [clusters] [output]
+Blank lines and lines starting with '#' are skipped. Without `clusters`
+the job uses the default one; without `output` its labels go to
+<input>.labels. Paths are taken as written (relative to the working
+directory). Each input is read in the --format given, or the one its
+extension implies (triplet_reader.h).
+
+Jobs run concurrently, one per worker thread, each fit single-threaded:
+small matrices parallelize much better across jobs than inside one. Idle
+workers take the next job from a shared queue (OpenMP dynamic schedule),
+largest input first so a big job does not start last. A memory budget
+(ReadOptions::maxMemory) is split evenly between the workers: each job's
+parse and fit are held to its worker's share, and a job over it fails
+without affecting the others. Each worker keeps
+one model for all its jobs, so its normalization, SVD and k-means
+workspaces are reused; fits draw from the model's own seeded RNG, so a
+job's labels do not depend on which worker ran it or when. A job's labels
+are written as soon as it finishes.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "adjacency_matrix.h"
+#include "parallel.h"
+#include "spectral_coclustering.h"
+#include "triplet_reader.h"
+
+struct BatchJob
+{
+    std::string input;
+    int clusters = 0;
+    std::string output;
+};
+
+/*
+Outcome of one job, handed to the caller's report as the job finishes.
+*/
+struct BatchResult
+{
+    const BatchJob *job = nullptr;
+    bool ok = false;
+    std::string error;
+    double seconds = 0.0;
+};
+
+/*
+Parse the manifest at `path`; jobs without a cluster count get
+`defaultClusters`. Returns false and fills `error` on failure.
+*/
+inline bool ReadManifest(const std::string &path, int defaultClusters, std::vector<BatchJob> &jobs,
+                         std::string &error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    jobs.clear();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line))
+    {
+        lineNumber++;
+        std::istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.input) || job.input[0] == '#')
+        {
+            continue;
+        }
+        std::string clusters;
+        job.clusters = defaultClusters;
+        if (fields >> clusters)
+        {
+            job.clusters = atoi(clusters.c_str());
+            if (job.clusters < 1)
+            {
+                error = "bad cluster count on line " + std::to_string(lineNumber) + " of " + path;
+                return false;
+            }
+        }
+        if (!(fields >> job.output))
+        {
+            job.output = job.input + ".labels";
+        }
+        jobs.push_back(job);
+    }
+    if (jobs.empty())
+    {
+        error = path + " lists no jobs";
+        return false;
+    }
+    return true;
+}
+
+/*
+Print row and column labels in the CLI's output format.
+*/
+inline void PrintLabels(std::ostream &out, const std::vector<int> &rowLabels, const std::vector<int> &columnLabels)
+{
+    for (size_t i = 0; i < rowLabels.size(); i++)
+    {
+        out << "row[" << i << "] = " << rowLabels[i] << '\n';
+    }
+    for (size_t i = 0; i < columnLabels.size(); i++)
+    {
+        out << "col[" << i << "] = " << columnLabels[i] << '\n';
+    }
+}
+
+/*
+Write the labels to the file at `path`, as PrintLabels() formats them.
+*/
+inline bool WriteLabels(const std::string &path, const std::vector<int> &rowLabels,
+                        const std::vector<int> &columnLabels, std::string &error)
+{
+    std::ofstream out(path);
+    PrintLabels(out, rowLabels, columnLabels);
+    out.close();
+    if (!out)
+    {
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+/*
+Whether a fit of `matrix` fits in `budget` bytes (0 = no budget) with the
+matrix itself; fills `error` when it does not.
+*/
+template <typename Model>
+bool WithinShare(const Model &model, const AdjacencyMatrix &matrix, size_t budget, std::string &error)
+{
+    size_t needed = StorageBytes(matrix) + model.memory_estimate(matrix);
+    if (budget > 0 && needed > budget)
+    {
+        error = "the fit needs about " + std::to_string((needed + (1 << 20) - 1) >> 20) + " MB, over this worker's "
+            + std::to_string(budget >> 20) + " MB share of the memory budget";
+        return false;
+    }
+    return true;
+}
+
+/*
+Run every job with a Model (SpectralCoclustering or its float variant)
+configured by `options` (the per-job cluster count aside) on
+`options.nThreads` workers. `report` is called once per job as it
+finishes, one call at a time. Returns the number of failed jobs.
+*/
+template <typename Model>
+int RunBatch(const std::vector<BatchJob> &jobs, const CoclusteringOptions &options, const ReadOptions &read,
+             const std::function<void(const BatchResult &)> &report)
+{
+    int count = (int) jobs.size();
+    int nWorkers = std::max(1, std::min(count, options.nThreads));
+
+    CoclusteringOptions jobOptions = options;
+    jobOptions.nThreads = 1;
+    ReadOptions jobRead = read;
+    jobRead.nThreads = 1;
+    jobRead.maxMemory = read.maxMemory / nWorkers;
+    std::vector<Model> workers(nWorkers, Model(jobOptions));
+
+    // Largest input first.
+    typedef std::pair<long long, int> SizedJob;
+    std::vector<SizedJob> order(count);
+    for (int j = 0; j < count; j++)
+    {
+        struct stat info;
+        order[j] = {stat(jobs[j].input.c_str(), &info) == 0 ? (long long) info.st_size : 0, j};
+    }
+    std::stable_sort(order.begin(), order.end(), [](const SizedJob &a, const SizedJob &b) { return a.first > b.first; });
+
+    int failed = 0;
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nWorkers) reduction(+ : failed)
+    for (int j = 0; j < count; j++)
+    {
+        const BatchJob &job = jobs[order[j].second];
+        Model &model = workers[nWorkers > 1 ? ThreadIndex() : 0];
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        BatchResult result;
+        result.job = &job;
+        AdjacencyMatrix matrix;
+        model.set_clusters(job.clusters);
+        result.ok = ReadMatrix(job.input, jobRead, matrix, result.error)
+            && WithinShare(model, matrix, jobRead.maxMemory, result.error) && model.fit(matrix, result.error)
+            && WriteLabels(job.output, model.row_labels(), model.column_labels(), result.error);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        failed += result.ok ? 0 : 1;
+
+        #pragma omp critical(batch_report)
+        report(result);
+    }
+    return failed;
+}
@@ -0,0 +1,406 @@
+/* benchmark.cpp
+End-to-end benchmark on planted bicluster matrices.
+
+For every size in the sweep: generate a planted matrix, write it as
+delimited text, then time parsing and each stage of
+SpectralCoclustering::fit(). Each case records throughput, peak resident
+memory and the adjusted Rand index of the recovered row + column labels
+against the planted ones, as CSV and/or JSON to diff across commits.
+
+With --sample, every size is also fitted approximately at each sampling
+rate (CoclusteringOptions::sampleRate); those rows add the agreement
+(adjusted Rand index) of their labels with the exact fit's.
+
+    g++ bench/benchmark.cpp -o benchmark -std=c++17 -O2 -fopenmp
+    ./benchmark --rows 1000,10000,100000,1000000 --cols 100 --k 10 --csv bench.csv
+    ./benchmark --rows 100000 --cols 2000 --k 10 --sample 0.5,0.2,0.1,0.05 --no-parse
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../delimited_reader.h"
+#include "../spectral_coclustering.h"
+#include "planted_bicluster.h"
+
+struct BenchmarkOptions
+{
+    std::vector<Eigen::Index> rows = {1000, 10000, 100000, 1000000};
+    std::vector<double> sampleRates = {1.0};  // the exact fit first, then approximate ones
+    PlantedOptions planted;
+    CoclusteringOptions model;
+    ReadOptions read;
+    bool parse = true;           // round-trip through delimited text
+    std::string tmpDir = "/tmp";
+    std::string csvPath;
+    std::string jsonPath;
+};
+
+struct BenchmarkResult
+{
+    Eigen::Index rows = 0;
+    Eigen::Index cols = 0;
+    Eigen::Index nonZeros = 0;
+    bool sparse = false;
+    double sampleRate = 1.0;
+    double parse = 0.0;
+    FitTimings fit;
+    double total = 0.0;
+    double rowsPerSecond = 0.0;
+    double peakRssMb = 0.0;
+    double ari = 0.0;
+    double agreement = 1.0;  // adjusted Rand index against the exact fit's labels
+};
+
+/*
+Parse `[options]`. Returns false on bad input.
+    --rows <n,n,...>       sweep of row counts
+    --cols <n>             columns of every case
+    --k <k>                planted (and requested) clusters
+    --density <p>          nonzero probability inside a bicluster
+    --noise <r>            off-bicluster probability relative to density
+    --seed <n>             generator seed
+    --threads <n>          worker threads
+    --sample <r,r,...>     also fit on these fractions of rows and columns
+    --sampling <uniform|degree>
+                           how the approximate fits draw their sample
+    --no-parse             skip the text round-trip, fit the generated matrix
+    --tmp <dir>            where the generated text files go
+    --csv <path>           write results as CSV
+    --json <path>          write results as JSON
+*/
+bool ParseArguments(int argc, char **argv, BenchmarkOptions &options);
+
+/*
+Adjusted Rand index between two labelings of the same items.
+*/
+double AdjustedRandIndex(const std::vector<int> &a, const std::vector<int> &b);
+
+/*
+Forget the peak resident set size so far (Linux >= 4.0), and read it back.
+*/
+void ResetPeakRss();
+double PeakRssMb();
+
+void WriteCsvHeader(std::ostream &out);
+void WriteCsvRow(std::ostream &out, const BenchmarkResult &result, const BenchmarkOptions &options);
+void WriteJson(std::ostream &out, const std::vector<BenchmarkResult> &results, const BenchmarkOptions &options);
+
+double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    BenchmarkOptions options;
+    if (!ParseArguments(argc, argv, options))
+    {
+        printf("usage: %s [--rows <n,n,...>] [--cols <n>] [--k <k>] [--density <p>] [--noise <r>]\n"
+               "          [--seed <n>] [--threads <n>] [--sample <r,r,...>] [--sampling uniform|degree]\n"
+               "          [--no-parse] [--tmp <dir>]\n"
+               "          [--csv <path>] [--json <path>]\n", argv[0]);
+        return 0;
+    }
+
+    std::vector<BenchmarkResult> results;
+    WriteCsvHeader(std::cout);
+    for (Eigen::Index rows : options.rows)
+    {
+        PlantedOptions plantedOptions = options.planted;
+        plantedOptions.rows = rows;
+        PlantedBiclusters planted;
+        GeneratePlanted(plantedOptions, planted);
+
+        BenchmarkResult result;
+        result.rows = rows;
+        result.cols = plantedOptions.cols;
+        result.nonZeros = planted.matrix.nonZeros();
+
+        AdjacencyMatrix matrix;
+        if (options.parse)
+        {
+            std::string path = options.tmpDir + "/planted_" + std::to_string(rows) + ".tsv";
+            std::string error;
+            if (!WritePlanted(path, planted.matrix, '\t', error))
+            {
+                printf("%s\n", error.c_str());
+                return 0;
+            }
+            planted.matrix = CsrMatrix();
+
+            ResetPeakRss();
+            auto start = std::chrono::steady_clock::now();
+            bool ok = ReadDelimited(path, options.read, matrix, error);
+            result.parse = Seconds(start);
+            remove(path.c_str());
+            if (!ok)
+            {
+                printf("%s\n", error.c_str());
+                return 0;
+            }
+        }
+        else
+        {
+            matrix.isSparse = true;
+            matrix.sparse.swap(planted.matrix);
+            ApplySparseThreshold(matrix, matrix.sparse.nonZeros(), options.read.sparseThreshold);
+            ResetPeakRss();
+        }
+        result.sparse = matrix.isSparse;
+
+        std::vector<int> truth = planted.rowLabels;
+        truth.insert(truth.end(), planted.columnLabels.begin(), planted.columnLabels.end());
+        std::vector<int> exact;
+        for (double rate : options.sampleRates)
+        {
+            // Peak memory of an approximate fit leaves out the parse.
+            if (rate < 1.0)
+            {
+                ResetPeakRss();
+            }
+            CoclusteringOptions modelOptions = options.model;
+            modelOptions.sampleRate = rate;
+            SpectralCoclustering model(modelOptions);
+            std::string error;
+            if (!model.fit(matrix, error))
+            {
+                printf("%s\n", error.c_str());
+                return 0;
+            }
+            result.sampleRate = rate;
+            result.peakRssMb = PeakRssMb();
+            result.fit = model.fit_timings();
+            result.total = result.parse + result.fit.sample + result.fit.normalize + result.fit.svd + result.fit.embed
+                + result.fit.kmeansInit + result.fit.kmeansIterations + result.fit.extend;
+            result.rowsPerSecond = rows / result.total;
+
+            std::vector<int> found = model.row_labels();
+            found.insert(found.end(), model.column_labels().begin(), model.column_labels().end());
+            result.ari = AdjustedRandIndex(found, truth);
+            if (exact.empty())
+            {
+                exact = found;
+            }
+            result.agreement = AdjustedRandIndex(found, exact);
+
+            results.push_back(result);
+            WriteCsvRow(std::cout, result, options);
+        }
+    }
+
+    if (!options.csvPath.empty())
+    {
+        std::ofstream out(options.csvPath);
+        WriteCsvHeader(out);
+        for (const BenchmarkResult &result : results)
+        {
+            WriteCsvRow(out, result, options);
+        }
+    }
+    if (!options.jsonPath.empty())
+    {
+        std::ofstream out(options.jsonPath);
+        WriteJson(out, results, options);
+    }
+    return 0;
+}
+
+bool ParseArguments(int argc, char **argv, BenchmarkOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--rows" && i + 1 < argc)
+        {
+            options.rows.clear();
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ','))
+            {
+                options.rows.push_back(atol(item.c_str()));
+            }
+        }
+        else if (arg == "--cols" && i + 1 < argc)
+        {
+            options.planted.cols = atol(argv[++i]);
+        }
+        else if (arg == "--k" && i + 1 < argc)
+        {
+            options.planted.k = atoi(argv[++i]);
+        }
+        else if (arg == "--density" && i + 1 < argc)
+        {
+            options.planted.density = atof(argv[++i]);
+        }
+        else if (arg == "--noise" && i + 1 < argc)
+        {
+            options.planted.noise = atof(argv[++i]);
+        }
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            options.planted.seed = atoi(argv[++i]);
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            options.model.nThreads = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--sample" && i + 1 < argc)
+        {
+            options.sampleRates = {1.0};
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ','))
+            {
+                double rate = atof(item.c_str());
+                if (!(rate > 0.0 && rate <= 1.0))
+                {
+                    return false;
+                }
+                if (rate < 1.0)
+                {
+                    options.sampleRates.push_back(rate);
+                }
+            }
+        }
+        else if (arg == "--sampling" && i + 1 < argc)
+        {
+            options.model.sampling = argv[++i];
+            if (options.model.sampling != "uniform" && options.model.sampling != "degree")
+            {
+                return false;
+            }
+        }
+        else if (arg == "--no-parse")
+        {
+            options.parse = false;
+        }
+        else if (arg == "--tmp" && i + 1 < argc)
+        {
+            options.tmpDir = argv[++i];
+        }
+        else if (arg == "--csv" && i + 1 < argc)
+        {
+            options.csvPath = argv[++i];
+        }
+        else if (arg == "--json" && i + 1 < argc)
+        {
+            options.jsonPath = argv[++i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+    options.model.clusters = options.planted.k;
+    options.read.nThreads = options.model.nThreads;
+
+    if (options.planted.k < 1 || options.planted.cols < options.planted.k + 1)
+    {
+        return false;
+    }
+    for (Eigen::Index rows : options.rows)
+    {
+        if (rows < options.planted.k + 1)
+        {
+            return false;
+        }
+    }
+    return !options.rows.empty();
+}
+
+double AdjustedRandIndex(const std::vector<int> &a, const std::vector<int> &b)
+{
+    int na = *std::max_element(a.begin(), a.end()) + 1;
+    int nb = *std::max_element(b.begin(), b.end()) + 1;
+    std::vector<double> table((size_t) na * nb, 0.0);
+    std::vector<double> rowTotals(na, 0.0);
+    std::vector<double> colTotals(nb, 0.0);
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        table[(size_t) a[i] * nb + b[i]] += 1;
+        rowTotals[a[i]] += 1;
+        colTotals[b[i]] += 1;
+    }
+
+    auto pairs = [](double n) { return n * (n - 1) / 2; };
+    double index = 0.0, sumA = 0.0, sumB = 0.0;
+    for (double n : table)
+    {
+        index += pairs(n);
+    }
+    for (double n : rowTotals)
+    {
+        sumA += pairs(n);
+    }
+    for (double n : colTotals)
+    {
+        sumB += pairs(n);
+    }
+    double expected = sumA * sumB / pairs((double) a.size());
+    double maximum = (sumA + sumB) / 2;
+    return maximum == expected ? 1.0 : (index - expected) / (maximum - expected);
+}
+
+void ResetPeakRss()
+{
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+}
+
+double PeakRssMb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            return atof(line.c_str() + 6) / 1024.0;
+        }
+    }
+    return 0.0;
+}
+
+void WriteCsvHeader(std::ostream &out)
+{
+    out << "rows,cols,k,density,noise,threads,nnz,sparse,sample_rate,parse_s,sample_s,normalize_s,svd_s,embed_s,"
+           "kmeans_init_s,lloyd_s,extend_s,total_s,rows_per_s,peak_rss_mb,ari,agreement\n";
+}
+
+void WriteCsvRow(std::ostream &out, const BenchmarkResult &r, const BenchmarkOptions &options)
+{
+    out << r.rows << ',' << r.cols << ',' << options.planted.k << ',' << options.planted.density << ','
+        << options.planted.noise << ',' << options.model.nThreads << ',' << r.nonZeros << ',' << r.sparse << ','
+        << r.sampleRate << ',' << r.parse << ',' << r.fit.sample << ',' << r.fit.normalize << ',' << r.fit.svd << ','
+        << r.fit.embed << ',' << r.fit.kmeansInit << ',' << r.fit.kmeansIterations << ',' << r.fit.extend << ','
+        << r.total << ',' << r.rowsPerSecond << ',' << r.peakRssMb << ',' << r.ari << ',' << r.agreement << '\n';
+    out.flush();
+}
+
+void WriteJson(std::ostream &out, const std::vector<BenchmarkResult> &results, const BenchmarkOptions &options)
+{
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult &r = results[i];
+        out << "  {\"rows\": " << r.rows << ", \"cols\": " << r.cols << ", \"k\": " << options.planted.k
+            << ", \"density\": " << options.planted.density << ", \"noise\": " << options.planted.noise
+            << ", \"threads\": " << options.model.nThreads << ", \"nnz\": " << r.nonZeros
+            << ", \"sparse\": " << (r.sparse ? "true" : "false") << ", \"sample_rate\": " << r.sampleRate
+            << ",\n   \"seconds\": {\"parse\": " << r.parse << ", \"sample\": " << r.fit.sample
+            << ", \"normalize\": " << r.fit.normalize
+            << ", \"svd\": " << r.fit.svd << ", \"embed\": " << r.fit.embed
+            << ", \"kmeans_init\": " << r.fit.kmeansInit << ", \"lloyd\": " << r.fit.kmeansIterations
+            << ", \"extend\": " << r.fit.extend << ", \"total\": " << r.total << "},\n   \"rows_per_s\": " << r.rowsPerSecond
+            << ", \"peak_rss_mb\": " << r.peakRssMb << ", \"ari\": " << r.ari << ", \"agreement\": " << r.agreement
+            << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "]\n";
+}
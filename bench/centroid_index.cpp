@@ -0,0 +1,262 @@
+/* centroid_index.cpp
+Nearest-centroid assignment: brute force against the k-d tree index.
+
+For every embedding dimension D and centroid count K in the sweep, draw N
+points around K Gaussian blob centers, start the centroids at K random
+points, and time one assignment step each way: the kernel run_lloyd
+would otherwise use (the fixed-dimension kernel, or the N x K distances
+above FixedDimMax) and assignClosestTree, including its per-iteration
+rebuild. Both must give the same labels. The speedup column shows where
+use_centroid_tree (KMeans/KMeans.h) should switch to the tree.
+
+    g++ bench/centroid_index.cpp -o centroid_index -std=c++17 -O2 -fopenmp
+    ./centroid_index --rows 100000 --k 16,64,256,1024,4096 --dims 2,4,8,16 --csv index.csv
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../KMeans/KMeans.h"
+
+struct IndexBenchmarkOptions
+{
+    int rows = 100000;
+    std::vector<int> clusters = {16, 64, 256, 1024, 4096};
+    std::vector<int> dims = {2, 4, 8, 16};
+    int nThreads = DefaultThreadCount();
+    int repeats = 3;         // best of this many timings
+    double spread = 0.02;    // blob standard deviation, centers are in [0, 1]^D
+    unsigned int seed = 1;
+    std::string csvPath;
+};
+
+struct IndexBenchmarkResult
+{
+    int dims = 0;
+    int clusters = 0;
+    double brute = 0.0;
+    double tree = 0.0;
+    bool match = false;
+};
+
+/*
+Parse `[options]`. Returns false on bad input.
+    --rows <n>             points per case
+    --k <n,n,...>          sweep of centroid counts
+    --dims <n,n,...>       sweep of dimensions, up to FixedDimMax
+    --threads <n>          worker threads
+    --repeats <n>          keep the best of n timings
+    --spread <s>           blob standard deviation
+    --seed <n>             generator seed
+    --csv <path>           write results as CSV
+*/
+bool ParseArguments(int argc, char **argv, IndexBenchmarkOptions &options);
+
+/*
+Comma-separated integers.
+*/
+std::vector<int> ParseList(const char *text);
+
+void WriteCsvHeader(std::ostream &out);
+void WriteCsvRow(std::ostream &out, const IndexBenchmarkResult &result, const IndexBenchmarkOptions &options);
+
+double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    IndexBenchmarkOptions options;
+    if (!ParseArguments(argc, argv, options))
+    {
+        printf("usage: %s [--rows <n>] [--k <n,n,...>] [--dims <n,n,...>] [--threads <n>]\n"
+               "          [--repeats <n>] [--spread <s>] [--seed <n>] [--csv <path>]\n", argv[0]);
+        return 0;
+    }
+
+    std::vector<IndexBenchmarkResult> results;
+    WriteCsvHeader(std::cout);
+    for (int D : options.dims)
+    {
+        for (int K : options.clusters)
+        {
+            std::mt19937 generator(options.seed);
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            std::normal_distribution<double> normal(0.0, options.spread);
+            std::uniform_int_distribution<int> pick(0, options.rows - 1);
+
+            int N = options.rows;
+            Mat centers(K, D);
+            for (int kk = 0; kk < K; kk++)
+            {
+                for (int d = 0; d < D; d++)
+                {
+                    centers(kk, d) = uniform(generator);
+                }
+            }
+            Mat points(N, D);
+            for (int nn = 0; nn < N; nn++)
+            {
+                int kk = nn % K;
+                for (int d = 0; d < D; d++)
+                {
+                    points(nn, d) = centers(kk, d) + normal(generator);
+                }
+            }
+            Mat centroids(K, D);
+            for (int kk = 0; kk < K; kk++)
+            {
+                centroids.row(kk) = points.row(pick(generator));
+            }
+
+            ExtMat X(points.data(), N, D);
+            ExtMat Mu(centroids.data(), K, D);
+            Vec bruteLabels(N);
+            Vec treeLabels(N);
+            ExtMat bruteZ(bruteLabels.data(), N, 1);
+            ExtMat treeZ(treeLabels.data(), N, 1);
+            KMeansWorkspace ws;
+            ws.reserve(N, K, D, options.nThreads);
+            ws.tree.reserve(K, D);
+            AssignRowsFn<double> kernel = fixed_dim_kernel<double>(D);
+            if (kernel == nullptr)
+            {
+                ws.Dist.resize(N, K);
+            }
+
+            IndexBenchmarkResult result;
+            result.dims = D;
+            result.clusters = K;
+            result.brute = result.tree = std::numeric_limits<double>::infinity();
+            double bruteDist = 0.0, treeDist = 0.0;
+            for (int r = 0; r < options.repeats; r++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                if (kernel != nullptr)
+                {
+                    bruteDist = assignClosestFixed(X, Mu, bruteZ, kernel, ws.MuBlocked, ws.partialDist,
+                                                   options.nThreads);
+                }
+                else
+                {
+                    bruteDist = assignClosest(X, Mu, bruteZ, ws.Dist, ws.partialDist, options.nThreads);
+                }
+                result.brute = std::min(result.brute, Seconds(start));
+
+                start = std::chrono::steady_clock::now();
+                treeDist = assignClosestTree(X, Mu, treeZ, ws.tree, ws.partialDist, options.nThreads);
+                result.tree = std::min(result.tree, Seconds(start));
+            }
+            result.match = (bruteLabels == treeLabels).all() && bruteDist == treeDist;
+
+            results.push_back(result);
+            WriteCsvRow(std::cout, result, options);
+        }
+    }
+
+    if (!options.csvPath.empty())
+    {
+        std::ofstream out(options.csvPath);
+        WriteCsvHeader(out);
+        for (const IndexBenchmarkResult &result : results)
+        {
+            WriteCsvRow(out, result, options);
+        }
+    }
+    return 0;
+}
+
+bool ParseArguments(int argc, char **argv, IndexBenchmarkOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--rows" && i + 1 < argc)
+        {
+            options.rows = atoi(argv[++i]);
+        }
+        else if (arg == "--k" && i + 1 < argc)
+        {
+            options.clusters = ParseList(argv[++i]);
+        }
+        else if (arg == "--dims" && i + 1 < argc)
+        {
+            options.dims = ParseList(argv[++i]);
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            options.nThreads = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--repeats" && i + 1 < argc)
+        {
+            options.repeats = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--spread" && i + 1 < argc)
+        {
+            options.spread = atof(argv[++i]);
+        }
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            options.seed = atoi(argv[++i]);
+        }
+        else if (arg == "--csv" && i + 1 < argc)
+        {
+            options.csvPath = argv[++i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (options.clusters.empty() || options.dims.empty())
+    {
+        return false;
+    }
+    for (int K : options.clusters)
+    {
+        if (K < 1 || K > options.rows)
+        {
+            return false;
+        }
+    }
+    for (int D : options.dims)
+    {
+        if (D < 1 || D > FixedDimMax)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<int> ParseList(const char *text)
+{
+    std::vector<int> values;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        values.push_back(atoi(item.c_str()));
+    }
+    return values;
+}
+
+void WriteCsvHeader(std::ostream &out)
+{
+    out << "rows,dims,k,threads,brute_s,tree_s,speedup,labels_match\n";
+}
+
+void WriteCsvRow(std::ostream &out, const IndexBenchmarkResult &r, const IndexBenchmarkOptions &options)
+{
+    out << options.rows << ',' << r.dims << ',' << r.clusters << ',' << options.nThreads << ',' << r.brute << ','
+        << r.tree << ',' << r.brute / r.tree << ',' << r.match << '\n';
+    out.flush();
+}
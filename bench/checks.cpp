@@ -0,0 +1,635 @@
+/* checks.cpp
+Exactness checks for the claims the fast paths make, on generated inputs.
+
+  kmeans    run_hamerly and run_elkan reach the same labels as run_lloyd
+            from the same starting centroids, points drawn around Gaussian
+            blobs.
+  objective the assignment total run_lloyd tests --kmeans-tol against is
+            the true inertia on every assignment path (including the
+            distance product above FixedDimMax), and a tolerance of 1
+            stops Lloyd after its second pass.
+  readers   the grid, Matrix Market, COO and edge-list readers build the
+            same matrix with 1 and --threads threads, from a planted
+            matrix written with its entries shuffled and some split into
+            duplicates. The COO and Matrix Market reads must also equal
+            the planted matrix itself.
+  predict   a model saved after an exact fit labels every training row and
+            column as the fit did (each lands on its own embedding).
+  sampled   after a sampled fit, every sampled row and column keeps the
+            label an exact fit of the sample's submatrix gives it.
+  warm      refitting the same matrix, rows shuffled, from the saved state
+            reproduces every row's and column's cluster id.
+
+The last three fit with --svd, an exact SVD by default: after the
+randomized one a projection is only as close to the embedding as that
+SVD's residual, and rows near a tie between two centroids can flip.
+
+Each check prints one line; the exit status is 1 when any of them fails.
+
+    g++ bench/checks.cpp -o checks -std=c++17 -O2 -fopenmp
+    ./checks --rows 2000 --cols 200 --k 8 --threads 3
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../KMeans/KMeans.h"
+#include "../spectral_coclustering.h"
+#include "../triplet_reader.h"
+#include "planted_bicluster.h"
+
+/*
+Default model options, with an exact SVD.
+*/
+CoclusteringOptions ExactSvd()
+{
+    CoclusteringOptions options;
+    options.svd.method = "bdc";
+    return options;
+}
+
+struct CheckOptions
+{
+    PlantedOptions planted;
+    CoclusteringOptions model = ExactSvd();
+    int points = 20000;   // k-means check
+    int centroids = 50;
+    int dims = 10;
+    double spread = 0.05;
+    double sampleRate = 0.5;
+    int nThreads = 3;
+    std::string tmpDir = "/tmp";
+};
+
+/*
+Parse `[options]`. Returns false on bad input.
+    --rows <n>             planted rows
+    --cols <n>             planted columns
+    --k <k>                planted (and requested) clusters
+    --density <p>          nonzero probability inside a bicluster
+    --noise <r>            off-bicluster probability relative to density
+    --points <n>           k-means points
+    --centroids <n>        k-means clusters
+    --dims <n>             k-means dimensions
+    --sample <r>           sampling rate of the sampled fit
+    --svd <method>         SVD of the fits (randomized, jacobi or bdc)
+    --seed <n>             generator seed
+    --threads <n>          thread count compared against 1 (at least 2)
+    --tmp <dir>            where the generated input files go
+*/
+bool ParseArguments(int argc, char **argv, CheckOptions &options);
+
+/*
+Print the outcome of one check and return `ok`.
+*/
+bool Report(const char *name, bool ok, const std::string &detail);
+
+bool CheckKMeans(const CheckOptions &options, std::string &detail);
+bool CheckObjective(const CheckOptions &options, std::string &detail);
+bool CheckReaders(const CheckOptions &options, const PlantedBiclusters &planted, std::string &detail);
+bool CheckPredict(const CheckOptions &options, const AdjacencyMatrix &input, std::string &detail);
+bool CheckSampled(const CheckOptions &options, const AdjacencyMatrix &input, std::string &detail);
+bool CheckWarm(const CheckOptions &options, const AdjacencyMatrix &input, std::string &detail);
+
+/*
+options.points points in D dimensions around options.centroids Gaussian
+blobs, and as many of them picked at random as starting centroids.
+*/
+void GenerateBlobs(const CheckOptions &options, int D, Mat &points, Mat &start);
+
+/*
+Write `matrix` in an entry layout (mtx, coo or edges), entries in random
+order and every value above 1 split into two entries of the same cell.
+*/
+bool WriteEntries(const std::string &path, const CsrMatrix &matrix, const std::string &layout, unsigned int seed,
+                  std::string &error);
+
+/*
+Whether two read matrices have the same storage, shape, labels and values,
+bit for bit.
+*/
+bool SameMatrix(const AdjacencyMatrix &a, const AdjacencyMatrix &b);
+
+/*
+`input` with its rows (and row labels) in a random order.
+*/
+void ShuffleRows(const AdjacencyMatrix &input, unsigned int seed, AdjacencyMatrix &output);
+
+/*
+Number of positions where two labelings differ, or -1 when their sizes do.
+*/
+long CountDifferent(const std::vector<int> &a, const std::vector<int> &b);
+
+int main(int argc, char **argv)
+{
+    CheckOptions options;
+    if (!ParseArguments(argc, argv, options))
+    {
+        printf("usage: %s [--rows <n>] [--cols <n>] [--k <k>] [--density <p>] [--noise <r>]\n"
+               "          [--points <n>] [--centroids <n>] [--dims <n>] [--sample <r>] [--svd <method>]\n"
+               "          [--seed <n>] [--threads <n>] [--tmp <dir>]\n", argv[0]);
+        return 0;
+    }
+
+    PlantedBiclusters planted;
+    GeneratePlanted(options.planted, planted);
+    AdjacencyMatrix input;
+    input.isSparse = true;
+    input.sparse = planted.matrix;
+    for (Eigen::Index i = 0; i < input.sparse.rows(); i++)
+    {
+        input.rowLabels.push_back('r' + std::to_string(i));
+    }
+    for (Eigen::Index j = 0; j < input.sparse.cols(); j++)
+    {
+        input.columnLabels.push_back('c' + std::to_string(j));
+    }
+
+    bool ok = true;
+    std::string detail;
+    ok = Report("kmeans: hamerly and elkan match lloyd", CheckKMeans(options, detail), detail) && ok;
+    ok = Report("kmeans: objective is the inertia", CheckObjective(options, detail), detail) && ok;
+    ok = Report("readers: independent of the thread count", CheckReaders(options, planted, detail), detail) && ok;
+    ok = Report("predict: training items keep their labels", CheckPredict(options, input, detail), detail) && ok;
+    ok = Report("sampled: sampled items keep their labels", CheckSampled(options, input, detail), detail) && ok;
+    ok = Report("warm: refit keeps cluster ids", CheckWarm(options, input, detail), detail) && ok;
+    return ok ? 0 : 1;
+}
+
+bool CheckKMeans(const CheckOptions &options, std::string &detail)
+{
+    int N = options.points;
+    int K = options.centroids;
+    int D = options.dims;
+    Mat points, start;
+    GenerateBlobs(options, D, points, start);
+
+    ExtMat X(points.data(), N, D);
+    const char *names[] = {"lloyd", "hamerly", "elkan"};
+    std::vector<Vec> labels(3, Vec(N));
+    for (int a = 0; a < 3; a++)
+    {
+        Mat centroids = start;
+        ExtMat Mu(centroids.data(), K, D);
+        ExtMat Z(labels[a].data(), N, 1);
+        if (a == 0)
+        {
+            run_lloyd(X, Mu, Z, options.model.maxIterations, options.nThreads);
+        }
+        else if (a == 1)
+        {
+            run_hamerly(X, Mu, Z, options.model.maxIterations, options.nThreads);
+        }
+        else
+        {
+            run_elkan(X, Mu, Z, options.model.maxIterations, options.nThreads);
+        }
+    }
+
+    detail.clear();
+    for (int a = 1; a < 3; a++)
+    {
+        long different = (labels[a] != labels[0]).count();
+        if (different > 0)
+        {
+            detail += std::string(detail.empty() ? "" : ", ") + names[a] + " differs on " + std::to_string(different)
+                + " of " + std::to_string(N) + " points";
+        }
+    }
+    return detail.empty();
+}
+
+bool CheckObjective(const CheckOptions &options, std::string &detail)
+{
+    // One dimension per assignment path: the k-d tree, the fixed-dimension
+    // kernels, and the distance product above FixedDimMax.
+    int N = options.points;
+    int K = options.centroids;
+    detail.clear();
+    for (int D : {4, FixedDimMax / 2 + 4, FixedDimMax + 8})
+    {
+        Mat points, start;
+        GenerateBlobs(options, D, points, start);
+        ExtMat X(points.data(), N, D);
+        Vec labels(N);
+        ExtMat Z(labels.data(), N, 1);
+
+        if (D > FixedDimMax)
+        {
+            Mat centroids = start;
+            ExtMat Mu(centroids.data(), K, D);
+            Mat Dist(N, K);
+            double total = assignClosest(X, Mu, Z, Dist, options.nThreads);
+            double inertia = calc_inertia(X, Mu, Z, options.nThreads);
+            if (fabs(total - inertia) > 1e-9 * inertia)
+            {
+                detail += std::string(detail.empty() ? "" : ", ") + "D = " + std::to_string(D) + ": assignment total "
+                    + std::to_string(total) + " vs inertia " + std::to_string(inertia);
+            }
+        }
+
+        // Any change is within a relative tolerance of 1, so Lloyd stops after its second pass.
+        Mat centroids = start;
+        ExtMat Mu(centroids.data(), K, D);
+        int iterations = run_lloyd(X, Mu, Z, options.model.maxIterations, options.nThreads, 1.0);
+        if (iterations != 2)
+        {
+            detail += std::string(detail.empty() ? "" : ", ") + "D = " + std::to_string(D) + ": --kmeans-tol 1 ran "
+                + std::to_string(iterations) + " iterations";
+        }
+    }
+    return detail.empty();
+}
+
+bool CheckReaders(const CheckOptions &options, const PlantedBiclusters &planted, std::string &detail)
+{
+    const char *layouts[] = {"tsv", "mtx", "coo", "edges"};
+    detail.clear();
+    for (const char *layout : layouts)
+    {
+        std::string path = options.tmpDir + "/checks_planted." + layout;
+        std::string error;
+        bool written = std::string(layout) == "tsv" ? WritePlanted(path, planted.matrix, '\t', error)
+                                                    : WriteEntries(path, planted.matrix, layout, options.planted.seed,
+                                                                   error);
+        if (!written)
+        {
+            detail = error;
+            return false;
+        }
+
+        ReadOptions single;
+        single.nThreads = 1;
+        ReadOptions parallel;
+        parallel.nThreads = options.nThreads;
+        AdjacencyMatrix one, many;
+        bool read = ReadMatrix(path, single, one, error) && ReadMatrix(path, parallel, many, error);
+        remove(path.c_str());
+        if (!read)
+        {
+            detail = error;
+            return false;
+        }
+        if (!SameMatrix(one, many))
+        {
+            detail += std::string(detail.empty() ? "" : ", ") + layout + " differs";
+        }
+
+        // 1-based (mtx) and 0-based (coo) ids keep the planted order.
+        bool byId = std::string(layout) == "mtx" || std::string(layout) == "coo";
+        Eigen::MatrixXd values = one.isSparse ? Eigen::MatrixXd(one.sparse) : one.dense;
+        if (byId && values != Eigen::MatrixXd(planted.matrix))
+        {
+            detail += std::string(detail.empty() ? "" : ", ") + layout + " differs from the planted matrix";
+        }
+    }
+    return detail.empty();
+}
+
+bool CheckPredict(const CheckOptions &options, const AdjacencyMatrix &input, std::string &detail)
+{
+    AdjacencyMatrix matrix = input;
+    SpectralCoclustering model(options.model);
+    if (!model.fit(matrix, detail))
+    {
+        return false;
+    }
+    WarmState state;
+    model.save_state(matrix, state);
+
+    CoclusteringPredictor predictor(state, options.nThreads);
+    std::vector<int> columnMap, rowMap, rowLabels, columnLabels;
+    predictor.MapColumns(matrix.columnLabels, columnMap);
+    predictor.PredictRows(matrix.Sparse(), columnMap, rowLabels);
+    predictor.MapRows(matrix.rowLabels, rowMap);
+    predictor.PredictColumns(matrix.Sparse(), rowMap, columnLabels);
+
+    long rows = CountDifferent(rowLabels, model.row_labels());
+    long cols = CountDifferent(columnLabels, model.column_labels());
+    detail = std::to_string(rows) + " rows and " + std::to_string(cols) + " columns differ";
+    return rows == 0 && cols == 0;
+}
+
+bool CheckSampled(const CheckOptions &options, const AdjacencyMatrix &input, std::string &detail)
+{
+    AdjacencyMatrix matrix = input;
+    CoclusteringOptions sampledOptions = options.model;
+    sampledOptions.sampleRate = options.sampleRate;
+    SpectralCoclustering sampled(sampledOptions);
+    if (!sampled.fit(matrix, detail))
+    {
+        return false;
+    }
+    WarmState state;
+    sampled.save_state(matrix, state);
+
+    // Refit the sample's submatrix exactly: the sampled fit ran the same fit on it.
+    std::vector<int> rowMap, columnMap;
+    MatchLabels(matrix.rowLabels, matrix.rows(), state.rowLabels, (Eigen::Index) state.rowLabels.size(), rowMap);
+    MatchLabels(matrix.columnLabels, matrix.cols(), state.columnLabels, (Eigen::Index) state.columnLabels.size(),
+                columnMap);
+    std::vector<int> rows = rowMap;
+    std::vector<int> cols = columnMap;
+    AdjacencyMatrix submatrix;
+    Submatrix(matrix, rows, cols, submatrix);
+    SpectralCoclustering exact(options.model);
+    if (!exact.fit(submatrix, detail))
+    {
+        return false;
+    }
+
+    long rowsDifferent = 0;
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+        rowsDifferent += sampled.row_labels()[rows[r]] != exact.row_labels()[r];
+    }
+    long colsDifferent = 0;
+    for (size_t c = 0; c < cols.size(); c++)
+    {
+        colsDifferent += sampled.column_labels()[cols[c]] != exact.column_labels()[c];
+    }
+    detail = std::to_string(rowsDifferent) + " of " + std::to_string(rows.size()) + " rows and "
+        + std::to_string(colsDifferent) + " of " + std::to_string(cols.size()) + " columns differ";
+    return rowsDifferent == 0 && colsDifferent == 0;
+}
+
+bool CheckWarm(const CheckOptions &options, const AdjacencyMatrix &input, std::string &detail)
+{
+    AdjacencyMatrix matrix = input;
+    SpectralCoclustering first(options.model);
+    if (!first.fit(matrix, detail))
+    {
+        return false;
+    }
+    WarmState state;
+    first.save_state(matrix, state);
+
+    AdjacencyMatrix shuffled;
+    ShuffleRows(input, options.planted.seed, shuffled);
+    SpectralCoclustering second(options.model);
+    second.set_warm_start(&state);
+    if (!second.fit(shuffled, detail))
+    {
+        return false;
+    }
+    if (!second.warm_started())
+    {
+        detail = "the refit started cold";
+        return false;
+    }
+
+    std::vector<int> rowMap;
+    MatchLabels(matrix.rowLabels, matrix.rows(), shuffled.rowLabels, shuffled.rows(), rowMap);
+    std::vector<int> expected(rowMap.size());
+    for (size_t i = 0; i < rowMap.size(); i++)
+    {
+        expected[i] = first.row_labels()[rowMap[i]];
+    }
+    long rows = CountDifferent(second.row_labels(), expected);
+    long cols = CountDifferent(second.column_labels(), first.column_labels());
+    detail = std::to_string(rows) + " rows and " + std::to_string(cols) + " columns changed cluster";
+    return rows == 0 && cols == 0;
+}
+
+void GenerateBlobs(const CheckOptions &options, int D, Mat &points, Mat &start)
+{
+    int N = options.points;
+    int K = options.centroids;
+    std::mt19937 generator(options.planted.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> normal(0.0, options.spread);
+    std::uniform_int_distribution<int> pick(0, N - 1);
+
+    Mat centers(K, D);
+    for (int kk = 0; kk < K; kk++)
+    {
+        for (int d = 0; d < D; d++)
+        {
+            centers(kk, d) = uniform(generator);
+        }
+    }
+    points.resize(N, D);
+    for (int nn = 0; nn < N; nn++)
+    {
+        for (int d = 0; d < D; d++)
+        {
+            points(nn, d) = centers(nn % K, d) + normal(generator);
+        }
+    }
+    start.resize(K, D);
+    for (int kk = 0; kk < K; kk++)
+    {
+        start.row(kk) = points.row(pick(generator));
+    }
+}
+
+bool Report(const char *name, bool ok, const std::string &detail)
+{
+    if (ok)
+    {
+        printf("%-46s ok\n", name);
+    }
+    else
+    {
+        printf("%-46s FAILED: %s\n", name, detail.c_str());
+    }
+    fflush(stdout);
+    return ok;
+}
+
+bool WriteEntries(const std::string &path, const CsrMatrix &matrix, const std::string &layout, unsigned int seed,
+                  std::string &error)
+{
+    std::vector<Eigen::Triplet<double>> entries;
+    for (Eigen::Index i = 0; i < matrix.rows(); i++)
+    {
+        for (CsrMatrix::InnerIterator it(matrix, i); it; ++it)
+        {
+            if (it.value() > 1.0)
+            {
+                entries.emplace_back(i, it.col(), 1.0);
+                entries.emplace_back(i, it.col(), it.value() - 1.0);
+            }
+            else
+            {
+                entries.emplace_back(i, it.col(), it.value());
+            }
+        }
+    }
+    std::mt19937_64 generator(seed);
+    std::shuffle(entries.begin(), entries.end(), generator);
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        error = "cannot write " + path;
+        return false;
+    }
+    if (layout == "mtx")
+    {
+        fprintf(file, "%%%%MatrixMarket matrix coordinate real general\n%ld %ld %zu\n", (long) matrix.rows(),
+                (long) matrix.cols(), entries.size());
+    }
+    for (const Eigen::Triplet<double> &entry : entries)
+    {
+        if (layout == "mtx")
+        {
+            fprintf(file, "%ld %ld %g\n", (long) entry.row() + 1, (long) entry.col() + 1, entry.value());
+        }
+        else if (layout == "coo")
+        {
+            fprintf(file, "%ld %ld %g\n", (long) entry.row(), (long) entry.col(), entry.value());
+        }
+        else
+        {
+            fprintf(file, "r%ld c%ld %g\n", (long) entry.row(), (long) entry.col(), entry.value());
+        }
+    }
+
+    bool ok = ferror(file) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        error = "failed writing " + path;
+    }
+    return ok;
+}
+
+bool SameMatrix(const AdjacencyMatrix &a, const AdjacencyMatrix &b)
+{
+    if (a.isSparse != b.isSparse || a.rows() != b.rows() || a.cols() != b.cols() || a.rowLabels != b.rowLabels
+        || a.columnLabels != b.columnLabels)
+    {
+        return false;
+    }
+    if (!a.isSparse)
+    {
+        return a.dense == b.dense;
+    }
+    const CsrMatrix &x = a.sparse;
+    const CsrMatrix &y = b.sparse;
+    return x.nonZeros() == y.nonZeros()
+        && std::equal(x.outerIndexPtr(), x.outerIndexPtr() + x.rows() + 1, y.outerIndexPtr())
+        && std::equal(x.innerIndexPtr(), x.innerIndexPtr() + x.nonZeros(), y.innerIndexPtr())
+        && std::equal(x.valuePtr(), x.valuePtr() + x.nonZeros(), y.valuePtr());
+}
+
+void ShuffleRows(const AdjacencyMatrix &input, unsigned int seed, AdjacencyMatrix &output)
+{
+    std::vector<int> order(input.sparse.rows());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = (int) i;
+    }
+    std::mt19937_64 generator(seed);
+    std::shuffle(order.begin(), order.end(), generator);
+
+    std::vector<Eigen::Triplet<double>> entries;
+    output.rowLabels.resize(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        output.rowLabels[i] = input.rowLabels[order[i]];
+        for (CsrMatrix::InnerIterator it(input.sparse, order[i]); it; ++it)
+        {
+            entries.emplace_back((int) i, it.col(), it.value());
+        }
+    }
+    output.isSparse = true;
+    output.sparse.resize(input.sparse.rows(), input.sparse.cols());
+    output.sparse.setFromTriplets(entries.begin(), entries.end());
+    output.columnLabels = input.columnLabels;
+}
+
+long CountDifferent(const std::vector<int> &a, const std::vector<int> &b)
+{
+    if (a.size() != b.size())
+    {
+        return -1;
+    }
+    long different = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        different += a[i] != b[i];
+    }
+    return different;
+}
+
+bool ParseArguments(int argc, char **argv, CheckOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--rows" && i + 1 < argc)
+        {
+            options.planted.rows = atol(argv[++i]);
+        }
+        else if (arg == "--cols" && i + 1 < argc)
+        {
+            options.planted.cols = atol(argv[++i]);
+        }
+        else if (arg == "--k" && i + 1 < argc)
+        {
+            options.planted.k = atoi(argv[++i]);
+            options.model.clusters = options.planted.k;
+        }
+        else if (arg == "--density" && i + 1 < argc)
+        {
+            options.planted.density = atof(argv[++i]);
+        }
+        else if (arg == "--noise" && i + 1 < argc)
+        {
+            options.planted.noise = atof(argv[++i]);
+        }
+        else if (arg == "--points" && i + 1 < argc)
+        {
+            options.points = atoi(argv[++i]);
+        }
+        else if (arg == "--centroids" && i + 1 < argc)
+        {
+            options.centroids = atoi(argv[++i]);
+        }
+        else if (arg == "--dims" && i + 1 < argc)
+        {
+            options.dims = atoi(argv[++i]);
+        }
+        else if (arg == "--sample" && i + 1 < argc)
+        {
+            options.sampleRate = atof(argv[++i]);
+        }
+        else if (arg == "--svd" && i + 1 < argc)
+        {
+            options.model.svd.method = argv[++i];
+        }
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            options.planted.seed = atoi(argv[++i]);
+            options.model.seed = options.planted.seed;
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            options.nThreads = atoi(argv[++i]);
+        }
+        else if (arg == "--tmp" && i + 1 < argc)
+        {
+            options.tmpDir = argv[++i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    options.planted.k = options.model.clusters;
+    const std::string &svd = options.model.svd.method;
+    if (svd != "randomized" && svd != "jacobi" && svd != "bdc")
+    {
+        return false;
+    }
+    options.model.nThreads = options.nThreads;
+    return options.nThreads >= 2 && options.planted.k >= 2 && options.planted.rows > options.planted.k
+        && options.planted.cols > options.planted.k && options.centroids >= 1 && options.centroids <= options.points
+        && options.dims >= 1 && options.sampleRate > 0.0 && options.sampleRate < 1.0;
+}
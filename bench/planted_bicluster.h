@@ -0,0 +1,196 @@
+/* planted_bicluster.h
+Synthetic block-diagonal bicluster matrices with known labels.
+
+Rows and columns are cut into k contiguous blocks of near-equal size; row
+block b and column block b form bicluster b. An entry is nonzero with
+probability `density` inside a bicluster and `noise * density` outside.
+Nonzero values are uniform integers in [1, 5]. Every row and column gets
+at least one nonzero inside its bicluster, so the readers never drop it
+and the planted labels stay aligned with the parsed matrix.
+*/
+
+#pragma once
+
+#include <charconv>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../adjacency_matrix.h"
+
+struct PlantedOptions
+{
+    Eigen::Index rows = 1000;
+    Eigen::Index cols = 100;
+    int k = 10;
+    double density = 0.3;  // nonzero probability inside a bicluster
+    double noise = 0.1;    // off-bicluster probability, relative to density
+    unsigned int seed = 1;
+};
+
+struct PlantedBiclusters
+{
+    CsrMatrix matrix;
+    std::vector<int> rowLabels;
+    std::vector<int> columnLabels;
+};
+
+/*
+Bicluster of index i out of n.
+*/
+inline int PlantedBlock(Eigen::Index i, Eigen::Index n, int k)
+{
+    return (int) (i * k / n);
+}
+
+/*
+First index of block b out of n.
+*/
+inline Eigen::Index PlantedBlockBegin(int b, Eigen::Index n, int k)
+{
+    return (b * n + k - 1) / k;
+}
+
+/*
+Append the columns of [begin, end) that come up nonzero with probability
+p, skipping ahead geometrically instead of flipping a coin per entry.
+*/
+template <typename Generator>
+int SampleSegment(Eigen::Index row, Eigen::Index begin, Eigen::Index end, double p, Generator &generator,
+                  std::vector<Eigen::Triplet<double>> &entries)
+{
+    if (p <= 0.0 || begin >= end)
+    {
+        return 0;
+    }
+    std::uniform_int_distribution<int> value(1, 5);
+    int count = 0;
+    if (p >= 1.0)
+    {
+        for (Eigen::Index j = begin; j < end; j++, count++)
+        {
+            entries.emplace_back(row, j, value(generator));
+        }
+        return count;
+    }
+    std::geometric_distribution<Eigen::Index> skip(p);
+    for (Eigen::Index j = begin + skip(generator); j < end; j += 1 + skip(generator), count++)
+    {
+        entries.emplace_back(row, j, value(generator));
+    }
+    return count;
+}
+
+inline void GeneratePlanted(const PlantedOptions &options, PlantedBiclusters &planted)
+{
+    Eigen::Index m = options.rows;
+    Eigen::Index n = options.cols;
+    int k = options.k;
+    double inside = options.density;
+    double outside = options.noise * options.density;
+
+    std::mt19937_64 generator(options.seed);
+    std::uniform_int_distribution<int> value(1, 5);
+    std::vector<Eigen::Triplet<double>> entries;
+    entries.reserve((size_t) (m * (n / k) * inside + m * n * outside) + m + n);
+
+    planted.rowLabels.resize(m);
+    planted.columnLabels.resize(n);
+    for (Eigen::Index j = 0; j < n; j++)
+    {
+        planted.columnLabels[j] = PlantedBlock(j, n, k);
+    }
+
+    std::vector<char> columnCovered(n, 0);
+    for (Eigen::Index i = 0; i < m; i++)
+    {
+        int b = PlantedBlock(i, m, k);
+        planted.rowLabels[i] = b;
+        Eigen::Index begin = PlantedBlockBegin(b, n, k);
+        Eigen::Index end = PlantedBlockBegin(b + 1, n, k);
+
+        SampleSegment(i, 0, begin, outside, generator, entries);
+        size_t first = entries.size();
+        if (SampleSegment(i, begin, end, inside, generator, entries) == 0)
+        {
+            std::uniform_int_distribution<Eigen::Index> column(begin, end - 1);
+            entries.emplace_back(i, column(generator), value(generator));
+        }
+        for (size_t p = first; p < entries.size(); p++)
+        {
+            columnCovered[entries[p].col()] = 1;
+        }
+        SampleSegment(i, end, n, outside, generator, entries);
+    }
+
+    for (Eigen::Index j = 0; j < n; j++)
+    {
+        if (!columnCovered[j])
+        {
+            int b = planted.columnLabels[j];
+            std::uniform_int_distribution<Eigen::Index> row(PlantedBlockBegin(b, m, k), PlantedBlockBegin(b + 1, m, k) - 1);
+            entries.emplace_back(row(generator), j, value(generator));
+        }
+    }
+
+    planted.matrix.resize(m, n);
+    planted.matrix.setFromTriplets(entries.begin(), entries.end());
+}
+
+/*
+Write `matrix` as delimited text in the layout ReadDelimited expects: a
+header of column labels, then a row label and one value per column.
+*/
+inline bool WritePlanted(const std::string &path, const CsrMatrix &matrix, char delimiter, std::string &error)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        error = "cannot write " + path;
+        return false;
+    }
+
+    std::string line = "id";
+    for (Eigen::Index j = 0; j < matrix.cols(); j++)
+    {
+        line += delimiter;
+        line += 'c' + std::to_string(j);
+    }
+    line += '\n';
+    fwrite(line.data(), 1, line.size(), file);
+
+    char number[32];
+    for (Eigen::Index i = 0; i < matrix.rows(); i++)
+    {
+        line = 'r' + std::to_string(i);
+        Eigen::Index next = 0;
+        for (CsrMatrix::InnerIterator it(matrix, i); it; ++it)
+        {
+            for (; next < it.col(); next++)
+            {
+                line += delimiter;
+                line += '0';
+            }
+            line += delimiter;
+            char *last = std::to_chars(number, number + sizeof(number), (int) it.value()).ptr;
+            line.append(number, last);
+            next++;
+        }
+        for (; next < matrix.cols(); next++)
+        {
+            line += delimiter;
+            line += '0';
+        }
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), file);
+    }
+
+    bool ok = ferror(file) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        error = "failed writing " + path;
+    }
+    return ok;
+}
@@ -0,0 +1,178 @@
+/* bistochastic.h
+Bistochastic scaling (Sinkhorn-Knopp) of a nonnegative matrix, the
+alternative to the one-step D_r^{-1/2} A D_c^{-1/2} scaling.
+
+Rows and columns are rescaled in turn until diag(r) A diag(c) has equal
+row sums and equal column sums. Heavy rows and columns then no longer
+dominate the leading singular vectors, which separates clusters of skewed
+inputs better (Kluger et al. 2003).
+
+The scaled matrix is never formed while iterating: an iteration is one
+A c product over the rows and one A^T r product, both on the stored
+nonzeros (or the dense storage) and split into nThreads ranges of rows.
+The transposed product scatters into one partial per range, reduced in
+range order so the result does not depend on scheduling. Only r and c
+are updated; the caller scales A once with them afterwards.
+
+The result is scaled so that row sums are sqrt(cols / rows) and column
+sums sqrt(rows / cols): the leading singular value is then 1, as after
+the one-step scaling, and singular values compare across modes.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Eigen/Dense"
+#include "adjacency_matrix.h"
+
+struct BistochasticOptions
+{
+    int maxIterations = 1000;
+    double tolerance = 1e-6;  // largest relative change of a column scale
+};
+
+/*
+Scratch space of Bistochastic, reused across calls of the same shape.
+*/
+struct BistochasticWorkspace
+{
+    Eigen::VectorXd rowProduct;                 // A c
+    std::vector<Eigen::VectorXd> columnPartial;  // A^T r, one per range
+};
+
+/*
+y = A x over rows [begin, end).
+*/
+inline void RowProduct(AdjacencyMatrix &matrix, const Eigen::VectorXd &x, Eigen::Index begin, Eigen::Index end,
+                       Eigen::VectorXd &y)
+{
+    if (matrix.isSparse)
+    {
+        CsrView A = matrix.Sparse();
+        const int *outer = A.outerIndexPtr();
+        const int *inner = A.innerIndexPtr();
+        const double *values = A.valuePtr();
+        for (Eigen::Index i = begin; i < end; i++)
+        {
+            double sum = 0.0;
+            for (int p = outer[i]; p < outer[i + 1]; p++)
+            {
+                sum += values[p] * x(inner[p]);
+            }
+            y(i) = sum;
+        }
+    }
+    else
+    {
+        y.segment(begin, end - begin).noalias() = matrix.Dense().middleRows(begin, end - begin) * x;
+    }
+}
+
+/*
+y = A^T x restricted to rows [begin, end) of A.
+*/
+inline void ColumnProduct(AdjacencyMatrix &matrix, const Eigen::VectorXd &x, Eigen::Index begin, Eigen::Index end,
+                          Eigen::VectorXd &y)
+{
+    if (matrix.isSparse)
+    {
+        CsrView A = matrix.Sparse();
+        const int *outer = A.outerIndexPtr();
+        const int *inner = A.innerIndexPtr();
+        const double *values = A.valuePtr();
+        y.setZero();
+        for (Eigen::Index i = begin; i < end; i++)
+        {
+            double xi = x(i);
+            for (int p = outer[i]; p < outer[i + 1]; p++)
+            {
+                y(inner[p]) += values[p] * xi;
+            }
+        }
+    }
+    else
+    {
+        y.noalias() = matrix.Dense().middleRows(begin, end - begin).transpose() * x.segment(begin, end - begin);
+    }
+}
+
+/*
+Sinkhorn-Knopp on `matrix` (nonnegative, with its sums computed): fills
+rowScale and colScale so that diag(rowScale) A diag(colScale) is
+bistochastic, stopping when no column scale changes by more than
+`options.tolerance` (relative) or after maxIterations.
+Empty rows and columns get a scale of 0. Returns the iterations run.
+*/
+inline int Bistochastic(AdjacencyMatrix &matrix, const BistochasticOptions &options, int nThreads,
+                        Eigen::VectorXd &rowScale, Eigen::VectorXd &colScale, BistochasticWorkspace &work)
+{
+    Eigen::Index m = matrix.rows();
+    Eigen::Index n = matrix.cols();
+    Eigen::Index liveRows = (matrix.rowSums.array() > 0.0).count();
+    Eigen::Index liveCols = (matrix.colSums.array() > 0.0).count();
+    double rowTarget = liveRows > 0 && liveCols > 0 ? std::sqrt((double) liveCols / (double) liveRows) : 1.0;
+    double colTarget = 1.0 / rowTarget;
+
+    // Start from the one-step scaling of the columns.
+    rowScale.resize(m);
+    colScale.resize(n);
+    for (Eigen::Index j = 0; j < n; j++)
+    {
+        colScale(j) = matrix.colSums(j) > 0.0 ? 1.0 / std::sqrt(matrix.colSums(j)) : 0.0;
+    }
+    work.rowProduct.resize(m);
+    work.columnPartial.resize(nThreads);
+
+    int iteration = 0;
+    double deviation;
+    do
+    {
+        iteration++;
+
+        // Rows: r = target / (A c), after which every row sum is on target.
+        #pragma omp parallel for schedule(static) num_threads(nThreads)
+        for (int t = 0; t < nThreads; t++)
+        {
+            Eigen::Index begin = m * t / nThreads;
+            Eigen::Index end = m * (t + 1) / nThreads;
+            RowProduct(matrix, colScale, begin, end, work.rowProduct);
+            for (Eigen::Index i = begin; i < end; i++)
+            {
+                double sum = work.rowProduct(i);
+                rowScale(i) = sum > 0.0 ? rowTarget / sum : 0.0;
+            }
+        }
+
+        // Columns: c = target / (A^T r). Once c stops moving, the column
+        // sums under the new r were already on target: both sides are.
+        #pragma omp parallel for schedule(static) num_threads(nThreads)
+        for (int t = 0; t < nThreads; t++)
+        {
+            work.columnPartial[t].resize(n);
+            ColumnProduct(matrix, rowScale, m * t / nThreads, m * (t + 1) / nThreads, work.columnPartial[t]);
+        }
+        Eigen::VectorXd &columnProduct = work.columnPartial[0];
+        for (int t = 1; t < nThreads; t++)
+        {
+            columnProduct += work.columnPartial[t];
+        }
+        deviation = 0.0;
+        for (Eigen::Index j = 0; j < n; j++)
+        {
+            double sum = columnProduct(j);
+            if (sum > 0.0)
+            {
+                deviation = std::max(deviation, std::abs(colScale(j) * sum / colTarget - 1.0));
+                colScale(j) = colTarget / sum;
+            }
+            else
+            {
+                colScale(j) = 0.0;
+            }
+        }
+    } while (deviation > options.tolerance && iteration < options.maxIterations);
+    return iteration;
+}
@@ -0,0 +1,489 @@
+/* delimited_reader.h
+Zero-copy CSV/TSV ingestion.
+
+The file is memory mapped and tokenized in place with std::from_chars.
+Values go straight into the final storage (a preallocated column-major
+Eigen::MatrixXd, or per-chunk CSR pieces for sparse inputs), so there is
+no per-cell allocation. Data lines are indexed once and split into chunks
+at newline boundaries, which are parsed on separate threads.
+
+Layout: an optional header line of column labels (with or without a
+leading corner cell), then one line per row: a row label followed by one
+value per column. The delimiter is detected from the first two lines
+unless given explicitly. The first line is taken as the header when its
+second field is not a number, since a data line always has a value there
+(ReadOptions::header overrides this, e.g. for numeric column labels);
+without a header the columns are labelled 1..n.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "adjacency_matrix.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+struct ReadOptions
+{
+    char delimiter = 0;  // 0 = detect
+    double sparseThreshold = DefaultSparseThreshold;
+    int nThreads = DefaultThreadCount();
+    size_t maxMemory = 0;  // bytes the parsed matrix may take, 0 = no limit
+    std::string format = "auto";  // grid, mtx, coo or edges; auto = by extension (triplet_reader.h)
+    std::string header = "auto";  // whether the first line is a header: yes, no, or auto = detect
+};
+
+/*
+Whether the first line is a header under options.header, given what
+detection concluded for this file.
+*/
+inline bool IsHeader(const ReadOptions &options, bool detected)
+{
+    return options.header == "yes" || (options.header == "auto" && detected);
+}
+
+/*
+End of the line starting at `p`, not counting "\n" or "\r\n".
+*/
+inline const char *LineEnd(const char *p, const char *end, const char **next)
+{
+    const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+    const char *lineEnd = newline ? newline : end;
+    *next = newline ? newline + 1 : end;
+    if (lineEnd > p && lineEnd[-1] == '\r')
+    {
+        --lineEnd;
+    }
+    return lineEnd;
+}
+
+inline size_t CountChar(const char *begin, const char *end, char c)
+{
+    return std::count(begin, end, c);
+}
+
+/*
+Pick the delimiter that occurs most often in the header and equally often
+in the first data line. Falls back to the most frequent header candidate,
+then to tab.
+*/
+inline char DetectDelimiter(const char *header, const char *headerEnd, const char *line, const char *lineEnd)
+{
+    const char candidates[] = {'\t', ',', ';', '|', ' '};
+    char best = 0;
+    size_t bestCount = 0;
+    char fallback = '\t';
+    size_t fallbackCount = 0;
+    for (char c : candidates)
+    {
+        size_t inHeader = CountChar(header, headerEnd, c);
+        size_t inLine = CountChar(line, lineEnd, c);
+        if (inHeader > fallbackCount)
+        {
+            fallback = c;
+            fallbackCount = inHeader;
+        }
+        if (inLine > 0 && (inHeader == inLine || inHeader + 1 == inLine) && inLine > bestCount)
+        {
+            best = c;
+            bestCount = inLine;
+        }
+    }
+    return best ? best : fallback;
+}
+
+/*
+Split one line into string tokens. Only used for the header.
+*/
+inline std::vector<std::string> SplitLine(const char *p, const char *lineEnd, char delimiter)
+{
+    std::vector<std::string> tokens;
+    while (true)
+    {
+        const char *fieldEnd = static_cast<const char *>(memchr(p, delimiter, lineEnd - p));
+        if (fieldEnd == nullptr)
+        {
+            fieldEnd = lineEnd;
+        }
+        const char *b = p;
+        const char *e = fieldEnd;
+        while (b < e && isspace((unsigned char) *b)) ++b;
+        while (e > b && isspace((unsigned char) e[-1])) --e;
+        tokens.emplace_back(b, e);
+        if (fieldEnd == lineEnd)
+        {
+            break;
+        }
+        p = fieldEnd + 1;
+    }
+    return tokens;
+}
+
+/*
+Parse the field starting at `p` and return a pointer to its terminating
+delimiter (or `lineEnd`). Empty fields read as zero.
+*/
+inline const char *ParseField(const char *p, const char *lineEnd, char delimiter, double &value, bool &ok)
+{
+    const char *fieldEnd = static_cast<const char *>(memchr(p, delimiter, lineEnd - p));
+    if (fieldEnd == nullptr)
+    {
+        fieldEnd = lineEnd;
+    }
+    const char *b = p;
+    const char *e = fieldEnd;
+    while (b < e && (*b == ' ' || *b == '\t')) ++b;
+    while (e > b && (e[-1] == ' ' || e[-1] == '\t')) --e;
+    if (b < e && *b == '+') ++b;
+
+    value = 0.0;
+    if (b < e)
+    {
+        std::from_chars_result parsed = std::from_chars(b, e, value);
+        ok = ok && parsed.ec == std::errc() && parsed.ptr == e;
+    }
+    return fieldEnd;
+}
+
+/*
+Parse one data line: the row label, then exactly `nCols` values which are
+handed to `store(column, value)`. Returns false on malformed lines.
+*/
+template <typename Store>
+bool ParseLine(const char *p, const char *lineEnd, char delimiter, Eigen::Index nCols,
+               const char **labelEnd, Store store)
+{
+    const char *fieldEnd = static_cast<const char *>(memchr(p, delimiter, lineEnd - p));
+    if (fieldEnd == nullptr)
+    {
+        return nCols == 0;
+    }
+    *labelEnd = fieldEnd;
+
+    bool ok = true;
+    Eigen::Index j = 0;
+    while (fieldEnd < lineEnd)
+    {
+        if (j == nCols)
+        {
+            return false;
+        }
+        double value;
+        fieldEnd = ParseField(fieldEnd + 1, lineEnd, delimiter, value, ok);
+        store(j++, value);
+    }
+    return ok && j == nCols;
+}
+
+inline Eigen::Index CountFields(const char *p, const char *lineEnd, char delimiter)
+{
+    return (Eigen::Index) CountChar(p, lineEnd, delimiter) + 1;
+}
+
+/*
+Index the non-empty lines of the grid in [begin, end), pick the delimiter,
+and split off the header line into `columnLabels` (see the layout above).
+On return `lines` holds the data lines only. Returns false and fills
+`error` on failure.
+*/
+inline bool IndexGrid(const char *begin, const char *end, const ReadOptions &options, const std::string &path,
+                      std::vector<const char *> &lines, char &delimiter, Eigen::Index &nCols,
+                      std::vector<std::string> &columnLabels, std::string &error)
+{
+    const char *next;
+    lines.clear();
+    for (const char *p = begin; p < end; p = next)
+    {
+        if (LineEnd(p, end, &next) > p)
+        {
+            lines.push_back(p);
+        }
+    }
+    if (lines.empty())
+    {
+        error = path + " has no data rows";
+        return false;
+    }
+
+    const char *firstEnd = LineEnd(lines[0], end, &next);
+    const char *second = lines.size() > 1 ? lines[1] : lines[0];
+    const char *secondEnd = LineEnd(second, end, &next);
+    delimiter = options.delimiter ? options.delimiter : DetectDelimiter(lines[0], firstEnd, second, secondEnd);
+
+    const char *labelEnd = static_cast<const char *>(memchr(lines[0], delimiter, firstEnd - lines[0]));
+    bool numeric = labelEnd != nullptr;
+    if (numeric)
+    {
+        double value;
+        ParseField(labelEnd + 1, firstEnd, delimiter, value, numeric);
+    }
+    bool hasHeader = IsHeader(options, !numeric);
+    if (hasHeader)
+    {
+        columnLabels = SplitLine(lines[0], firstEnd, delimiter);
+        lines.erase(lines.begin());
+        if (lines.empty())
+        {
+            error = path + " has no data rows";
+            return false;
+        }
+    }
+
+    const char *dataEnd = LineEnd(lines[0], end, &next);
+    nCols = CountFields(lines[0], dataEnd, delimiter) - 1;
+    if (!hasHeader)
+    {
+        columnLabels.resize(nCols);
+        for (Eigen::Index j = 0; j < nCols; j++)
+        {
+            columnLabels[j] = std::to_string(j + 1);
+        }
+        return true;
+    }
+    if ((Eigen::Index) columnLabels.size() == nCols + 1)
+    {
+        columnLabels.erase(columnLabels.begin());
+    }
+    if ((Eigen::Index) columnLabels.size() != nCols)
+    {
+        error = "header has " + std::to_string(columnLabels.size()) + " columns but rows have "
+            + std::to_string(nCols) + " values";
+        return false;
+    }
+    return true;
+}
+
+/*
+Estimated peak bytes of parsing an m x n input of the given density: the
+line index and row labels, plus the dense matrix, or the per-chunk CSR
+pieces and the final CSR, which are both alive while the pieces are
+copied into place.
+*/
+inline size_t ParseBytes(Eigen::Index m, Eigen::Index n, double density, bool sparse)
+{
+    size_t bytes = (size_t) m * (sizeof(const char *) + sizeof(std::string));
+    if (sparse)
+    {
+        size_t nonZeros = (size_t) (density * (double) m * (double) n);
+        return bytes + 2 * nonZeros * (sizeof(double) + sizeof(int)) + 2 * (size_t) (m + 1) * sizeof(int);
+    }
+    return bytes + (size_t) m * (size_t) n * sizeof(double);
+}
+
+/*
+Read a delimited file into `matrix`. Rows whose values sum to zero are
+dropped, as before. The storage is chosen from a sample of rows and then
+corrected with the exact density once all nonzeros are counted. Returns
+false and fills `error` on failure.
+*/
+inline bool ReadDelimited(const std::string &path, const ReadOptions &options, AdjacencyMatrix &matrix, std::string &error)
+{
+    MappedFile file;
+    if (!file.Open(path))
+    {
+        error = "cannot map " + path;
+        return false;
+    }
+    file.Advise(MADV_SEQUENTIAL);
+    const char *end = file.End();
+
+    // Index the data lines and take the column labels from the header.
+    const char *next;
+    std::vector<const char *> lines;
+    char delimiter;
+    Eigen::Index n;
+    if (!IndexGrid(file.Begin(), end, options, path, lines, delimiter, n, matrix.columnLabels, error))
+    {
+        return false;
+    }
+    Eigen::Index m = (Eigen::Index) lines.size();
+
+    // Estimate density from an evenly spaced sample of rows.
+    Eigen::Index sampleStep = std::max<Eigen::Index>(1, m / 256);
+    size_t sampledNonZeros = 0;
+    size_t sampledValues = 0;
+    for (Eigen::Index i = 0; i < m; i += sampleStep)
+    {
+        const char *lineEnd = LineEnd(lines[i], end, &next);
+        const char *labelEnd;
+        ParseLine(lines[i], lineEnd, delimiter, n, &labelEnd, [&](Eigen::Index, double v) {
+            sampledNonZeros += v != 0.0;
+        });
+        sampledValues += n;
+    }
+    double sampledDensity = sampledValues > 0 ? (double) sampledNonZeros / (double) sampledValues : 0.0;
+    bool parseSparse = sampledValues > 0 && sampledDensity < options.sparseThreshold;
+
+    // Refuse an input over the memory budget before allocating anything for it.
+    size_t needed = ParseBytes(m, n, sampledDensity, parseSparse);
+    if (options.maxMemory > 0 && needed > options.maxMemory)
+    {
+        error = "parsing " + path + " needs about " + std::to_string((needed + (1 << 20) - 1) >> 20) + " MB, over the "
+            + std::to_string(options.maxMemory >> 20) + " MB memory budget";
+        return false;
+    }
+
+    int nChunks = std::max(1, std::min<int>(options.nThreads * 8, (int) m));
+    std::vector<Eigen::Index> chunkBegin(nChunks + 1);
+    for (int c = 0; c <= nChunks; c++)
+    {
+        chunkBegin[c] = m * c / nChunks;
+    }
+
+    std::vector<char> keep(m);
+    std::vector<Eigen::Index> badLine(nChunks, -1);
+    std::vector<size_t> chunkNonZeros(nChunks, 0);
+    matrix.rowLabels.assign(m, std::string());
+
+    // Sparse pieces, one per chunk.
+    std::vector<std::vector<int>> chunkRowNnz(parseSparse ? nChunks : 0);
+    std::vector<std::vector<int>> chunkInner(parseSparse ? nChunks : 0);
+    std::vector<std::vector<double>> chunkValues(parseSparse ? nChunks : 0);
+    if (!parseSparse)
+    {
+        matrix.dense.resize(m, n);
+    }
+
+    #pragma omp parallel for schedule(dynamic) num_threads(options.nThreads)
+    for (int c = 0; c < nChunks; c++)
+    {
+        const char *next;
+        for (Eigen::Index i = chunkBegin[c]; i < chunkBegin[c + 1]; i++)
+        {
+            const char *lineEnd = LineEnd(lines[i], end, &next);
+            const char *labelEnd = lineEnd;
+            double sum = 0.0;
+            size_t nonZeros = 0;
+            bool ok;
+            if (parseSparse)
+            {
+                std::vector<int> &inner = chunkInner[c];
+                std::vector<double> &values = chunkValues[c];
+                size_t before = values.size();
+                ok = ParseLine(lines[i], lineEnd, delimiter, n, &labelEnd, [&](Eigen::Index j, double v) {
+                    if (v != 0.0)
+                    {
+                        inner.push_back((int) j);
+                        values.push_back(v);
+                        sum += v;
+                    }
+                });
+                nonZeros = values.size() - before;
+                chunkRowNnz[c].push_back((int) nonZeros);
+            }
+            else
+            {
+                ok = ParseLine(lines[i], lineEnd, delimiter, n, &labelEnd, [&](Eigen::Index j, double v) {
+                    matrix.dense(i, j) = v;
+                    sum += v;
+                    nonZeros += v != 0.0;
+                });
+            }
+            if (!ok && badLine[c] < 0)
+            {
+                badLine[c] = i;
+            }
+            keep[i] = sum > 0.0;
+            if (keep[i])
+            {
+                chunkNonZeros[c] += nonZeros;
+            }
+            matrix.rowLabels[i].assign(lines[i], labelEnd);
+        }
+    }
+
+    for (int c = 0; c < nChunks; c++)
+    {
+        if (badLine[c] >= 0)
+        {
+            error = "malformed data row " + std::to_string(badLine[c] + 1) + " in " + path;
+            return false;
+        }
+    }
+
+    // Drop zero-sum rows.
+    std::vector<Eigen::Index> keptRows;
+    keptRows.reserve(m);
+    for (Eigen::Index i = 0; i < m; i++)
+    {
+        if (keep[i])
+        {
+            keptRows.push_back(i);
+        }
+    }
+    Eigen::Index kept = (Eigen::Index) keptRows.size();
+    for (Eigen::Index r = 0; r < kept; r++)
+    {
+        if (keptRows[r] != r)
+        {
+            matrix.rowLabels[r].swap(matrix.rowLabels[keptRows[r]]);
+        }
+    }
+    matrix.rowLabels.resize(kept);
+
+    size_t nonZeros = 0;
+    for (int c = 0; c < nChunks; c++)
+    {
+        nonZeros += chunkNonZeros[c];
+    }
+
+    matrix.isSparse = parseSparse;
+    if (parseSparse)
+    {
+        // Prefix sum of kept row lengths, then copy chunks into place.
+        std::vector<int> outer(kept + 1, 0);
+        std::vector<int> chunkFirstRow(nChunks + 1, 0);
+        Eigen::Index r = 0;
+        for (int c = 0; c < nChunks; c++)
+        {
+            chunkFirstRow[c] = (int) r;
+            for (Eigen::Index i = chunkBegin[c]; i < chunkBegin[c + 1]; i++)
+            {
+                if (keep[i])
+                {
+                    outer[r + 1] = outer[r] + chunkRowNnz[c][i - chunkBegin[c]];
+                    r++;
+                }
+            }
+        }
+
+        CsrMatrix &sparse = matrix.sparse;
+        sparse.resize(kept, n);
+        sparse.resizeNonZeros((Eigen::Index) nonZeros);
+        std::copy(outer.begin(), outer.end(), sparse.outerIndexPtr());
+
+        #pragma omp parallel for schedule(dynamic) num_threads(options.nThreads)
+        for (int c = 0; c < nChunks; c++)
+        {
+            int row = chunkFirstRow[c];
+            size_t source = 0;
+            for (Eigen::Index i = chunkBegin[c]; i < chunkBegin[c + 1]; i++)
+            {
+                int length = chunkRowNnz[c][i - chunkBegin[c]];
+                if (keep[i])
+                {
+                    std::copy_n(chunkInner[c].begin() + source, length, sparse.innerIndexPtr() + outer[row]);
+                    std::copy_n(chunkValues[c].begin() + source, length, sparse.valuePtr() + outer[row]);
+                    row++;
+                }
+                source += length;
+            }
+            std::vector<int>().swap(chunkInner[c]);
+            std::vector<double>().swap(chunkValues[c]);
+        }
+    }
+    else if (kept < m)
+    {
+        Eigen::MatrixXd compact = matrix.dense(keptRows, Eigen::all);
+        matrix.dense.swap(compact);
+    }
+
+    ApplySparseThreshold(matrix, (Eigen::Index) nonZeros, options.sparseThreshold);
+    return true;
+}
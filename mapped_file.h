@@ -0,0 +1,71 @@
+/* mapped_file.h
+RAII wrapper around mmap(2).
+*/
+
+#pragma once
+
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Memory mapping of a whole file. A writable mapping is private
+(copy-on-write): stores never reach the file on disk.
+*/
+class MappedFile
+{
+public:
+    MappedFile() : data(nullptr), size(0) {}
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool Open(const std::string &path, bool writable = false)
+    {
+        Close();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        void *mapping = mmap(nullptr, info.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        data = static_cast<char *>(mapping);
+        size = info.st_size;
+        return true;
+    }
+
+    void Close()
+    {
+        if (data != nullptr)
+        {
+            munmap(data, size);
+            data = nullptr;
+            size = 0;
+        }
+    }
+
+    void Advise(int advice) { madvise(data, size, advice); }
+
+    char *Begin() const { return data; }
+    char *End() const { return data + size; }
+    size_t Size() const { return size; }
+
+private:
+    char *data;
+    size_t size;
+};
@@ -0,0 +1,415 @@
+/* matrix_cache.h
+Binary cache of a parsed adjacency matrix, for repeated runs on the same
+input while tuning k and seeds.
+
+The cache is loaded with a private (copy-on-write) mmap and the matrix is
+used in place through Eigen::Map, so a warm start neither parses nor
+copies the matrix. It is tied to its source file by size and mtime, or
+additionally by a content hash when requested, and to the read options
+that shape the parsed matrix (input format, delimiter, header, sparse
+threshold).
+A cache whose index arrays are out of range is rejected like a stale one.
+
+Layout (native endianness, every section 64-byte aligned):
+  CacheHeader
+  labels   : row labels then column labels, each a uint32 length + bytes
+  rowSums  : double[rows]
+  colSums  : double[cols]
+  values   : double[rows * cols] column-major (dense) or double[nnz] (CSR)
+  outer    : int32[rows + 1]   (CSR only)
+  inner    : int32[nnz]        (CSR only)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "adjacency_matrix.h"
+#include "delimited_reader.h"
+#include "mapped_file.h"
+
+const char CacheMagic[8] = {'S', 'C', 'C', 'A', 'C', 'H', 'E', '\0'};
+const uint32_t CacheVersion = 4;
+const uint64_t CacheAlignment = 64;
+
+/*
+Identity of the source file a cache was built from.
+*/
+struct SourceStamp
+{
+    uint64_t size = 0;
+    int64_t mtimeSec = 0;
+    int64_t mtimeNsec = 0;
+    uint64_t hash = 0;  // 0 when not hashed
+};
+
+/*
+Read options the parsed matrix depends on. `format` is the resolved one
+(see InputFormat), never "auto".
+*/
+struct ReadStamp
+{
+    double sparseThreshold = 0.0;
+    uint32_t delimiter = 0;
+    char format[12] = {};
+    char header[8] = {};
+};
+
+inline ReadStamp StampRead(const ReadOptions &options, const std::string &format)
+{
+    ReadStamp stamp;
+    stamp.sparseThreshold = options.sparseThreshold;
+    stamp.delimiter = (unsigned char) options.delimiter;
+    strncpy(stamp.format, format.c_str(), sizeof(stamp.format) - 1);
+    strncpy(stamp.header, options.header.c_str(), sizeof(stamp.header) - 1);
+    return stamp;
+}
+
+inline bool ReadStampMatches(const ReadStamp &cached, const ReadStamp &current)
+{
+    return cached.sparseThreshold == current.sparseThreshold && cached.delimiter == current.delimiter
+        && strncmp(cached.format, current.format, sizeof(cached.format)) == 0
+        && strncmp(cached.header, current.header, sizeof(cached.header)) == 0;
+}
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t isSparse;
+    int64_t rows;
+    int64_t cols;
+    int64_t nonZeros;
+    SourceStamp source;
+    ReadStamp read;
+    uint64_t labelsOffset;
+    uint64_t rowSumsOffset;
+    uint64_t colSumsOffset;
+    uint64_t valuesOffset;
+    uint64_t outerOffset;
+    uint64_t innerOffset;
+    uint64_t fileSize;
+};
+
+inline uint64_t AlignUp(uint64_t offset)
+{
+    return (offset + CacheAlignment - 1) / CacheAlignment * CacheAlignment;
+}
+
+/*
+64-bit FNV-1a style hash, one 8-byte word per step.
+*/
+inline uint64_t HashBytes(const char *data, size_t size)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    size_t words = size / 8;
+    for (size_t w = 0; w < words; w++)
+    {
+        uint64_t word;
+        memcpy(&word, data + 8 * w, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for (size_t i = 8 * words; i < size; i++)
+    {
+        hash = (hash ^ (unsigned char) data[i]) * 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+/*
+Stat `path` (and hash its contents when `withHash`).
+*/
+inline bool StampSource(const std::string &path, bool withHash, SourceStamp &stamp)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+        return false;
+    }
+    stamp.size = info.st_size;
+    stamp.mtimeSec = info.st_mtim.tv_sec;
+    stamp.mtimeNsec = info.st_mtim.tv_nsec;
+    stamp.hash = 0;
+    if (withHash)
+    {
+        MappedFile file;
+        if (!file.Open(path))
+        {
+            return false;
+        }
+        file.Advise(MADV_SEQUENTIAL);
+        stamp.hash = HashBytes(file.Begin(), file.Size());
+    }
+    return true;
+}
+
+/*
+A cache matches when the size agrees and either the hashes agree (if one
+was requested) or the mtimes agree.
+*/
+inline bool StampMatches(const SourceStamp &cached, const SourceStamp &current)
+{
+    if (cached.size != current.size)
+    {
+        return false;
+    }
+    if (current.hash != 0)
+    {
+        return cached.hash == current.hash;
+    }
+    return cached.mtimeSec == current.mtimeSec && cached.mtimeNsec == current.mtimeNsec;
+}
+
+inline void WritePadding(std::ofstream &out, uint64_t &offset)
+{
+    static const char zeros[CacheAlignment] = {};
+    uint64_t aligned = AlignUp(offset);
+    out.write(zeros, aligned - offset);
+    offset = aligned;
+}
+
+inline void WriteSection(std::ofstream &out, uint64_t &offset, const void *data, uint64_t bytes)
+{
+    WritePadding(out, offset);
+    out.write(static_cast<const char *>(data), bytes);
+    offset += bytes;
+}
+
+/*
+Write `matrix` (with its row/column sums, which must be computed) to
+`cachePath`. The file is written next to its final name and renamed into
+place, so readers never see a partial cache.
+*/
+inline bool WriteCache(const std::string &cachePath, AdjacencyMatrix &matrix, const SourceStamp &source,
+                       const ReadStamp &read, std::string &error)
+{
+    CacheHeader header = CacheHeader();
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.version = CacheVersion;
+    header.isSparse = matrix.isSparse;
+    header.rows = matrix.rows();
+    header.cols = matrix.cols();
+    header.nonZeros = matrix.isSparse ? matrix.Sparse().nonZeros() : header.rows * header.cols;
+    header.source = source;
+    header.read = read;
+
+    std::string labels;
+    for (const std::vector<std::string> *list : {&matrix.rowLabels, &matrix.columnLabels})
+    {
+        for (const std::string &label : *list)
+        {
+            uint32_t length = (uint32_t) label.size();
+            labels.append(reinterpret_cast<const char *>(&length), sizeof(length));
+            labels.append(label);
+        }
+    }
+
+    uint64_t offset = sizeof(CacheHeader);
+    header.labelsOffset = AlignUp(offset);
+    offset = header.labelsOffset + labels.size();
+    header.rowSumsOffset = AlignUp(offset);
+    offset = header.rowSumsOffset + sizeof(double) * header.rows;
+    header.colSumsOffset = AlignUp(offset);
+    offset = header.colSumsOffset + sizeof(double) * header.cols;
+    header.valuesOffset = AlignUp(offset);
+    offset = header.valuesOffset + sizeof(double) * header.nonZeros;
+    if (matrix.isSparse)
+    {
+        header.outerOffset = AlignUp(offset);
+        offset = header.outerOffset + sizeof(int) * (header.rows + 1);
+        header.innerOffset = AlignUp(offset);
+        offset = header.innerOffset + sizeof(int) * header.nonZeros;
+    }
+    header.fileSize = offset;
+
+    std::string temporary = cachePath + ".tmp";
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        error = "cannot write " + temporary;
+        return false;
+    }
+
+    offset = 0;
+    WriteSection(out, offset, &header, sizeof(header));
+    WriteSection(out, offset, labels.data(), labels.size());
+    WriteSection(out, offset, matrix.rowSums.data(), sizeof(double) * header.rows);
+    WriteSection(out, offset, matrix.colSums.data(), sizeof(double) * header.cols);
+    if (matrix.isSparse)
+    {
+        CsrView sparse = matrix.Sparse();
+        WriteSection(out, offset, sparse.valuePtr(), sizeof(double) * header.nonZeros);
+        WriteSection(out, offset, sparse.outerIndexPtr(), sizeof(int) * (header.rows + 1));
+        WriteSection(out, offset, sparse.innerIndexPtr(), sizeof(int) * header.nonZeros);
+    }
+    else
+    {
+        WriteSection(out, offset, matrix.Dense().data(), sizeof(double) * header.nonZeros);
+    }
+    out.close();
+    if (!out || rename(temporary.c_str(), cachePath.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        error = "cannot write " + cachePath;
+        return false;
+    }
+    return true;
+}
+
+/*
+Bytes of the values and indices of `matrix`, owned or mapped: what parsing
+its source into memory holds.
+*/
+inline size_t MatrixBytes(const AdjacencyMatrix &matrix)
+{
+    if (!matrix.IsMapped())
+    {
+        return StorageBytes(matrix);
+    }
+    if (matrix.isSparse)
+    {
+        return (size_t) matrix.mapped.nonZeros * (sizeof(double) + sizeof(int))
+            + (size_t) (matrix.mapped.rows + 1) * sizeof(int);
+    }
+    return (size_t) matrix.mapped.rows * (size_t) matrix.mapped.cols * sizeof(double);
+}
+
+/*
+Whether the mapped CSR arrays form a valid rows x cols matrix: outer
+starts at 0, never decreases and ends at nonZeros, and every inner index
+is a column.
+*/
+inline bool ValidCsr(const int *outer, const int *inner, int64_t rows, int64_t cols, int64_t nonZeros)
+{
+    if (outer[0] != 0 || outer[rows] != nonZeros)
+    {
+        return false;
+    }
+    for (int64_t i = 0; i < rows; i++)
+    {
+        if (outer[i + 1] < outer[i])
+        {
+            return false;
+        }
+    }
+    for (int64_t p = 0; p < nonZeros; p++)
+    {
+        if (inner[p] < 0 || inner[p] >= cols)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Map `cachePath` into `matrix` if it exists and matches `source` and
+`read`. Returns false (with the reason in `error`) when the cache is
+missing, stale or corrupt; the caller then falls back to parsing the
+source.
+*/
+inline bool LoadCache(const std::string &cachePath, const SourceStamp &source, const ReadStamp &read,
+                      AdjacencyMatrix &matrix, std::string &error)
+{
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    if (!file->Open(cachePath, true))
+    {
+        error = "no cache at " + cachePath;
+        return false;
+    }
+
+    CacheHeader header;
+    if (file->Size() < sizeof(header))
+    {
+        error = cachePath + " is truncated";
+        return false;
+    }
+    memcpy(&header, file->Begin(), sizeof(header));
+    if (memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0 || header.version != CacheVersion
+        || header.fileSize != file->Size() || header.rows < 0 || header.cols < 0 || header.nonZeros < 0
+        || header.rows >= std::numeric_limits<int>::max() || header.cols >= std::numeric_limits<int>::max()
+        || (header.isSparse ? header.nonZeros >= std::numeric_limits<int>::max()
+                            : header.nonZeros != header.rows * header.cols)
+        || header.labelsOffset > header.fileSize || header.rowSumsOffset > header.fileSize
+        || header.colSumsOffset > header.fileSize || header.valuesOffset > header.fileSize
+        || header.outerOffset > header.fileSize || header.innerOffset > header.fileSize)
+    {
+        error = cachePath + " is not a valid cache";
+        return false;
+    }
+    uint64_t valuesEnd = header.valuesOffset + sizeof(double) * header.nonZeros;
+    uint64_t indexEnd = header.innerOffset + sizeof(int) * header.nonZeros;
+    if (header.labelsOffset > header.rowSumsOffset
+        || header.rowSumsOffset + sizeof(double) * header.rows > header.colSumsOffset
+        || header.colSumsOffset + sizeof(double) * header.cols > header.valuesOffset
+        || valuesEnd > header.fileSize
+        || (header.isSparse && (header.outerOffset + sizeof(int) * (header.rows + 1) > header.innerOffset
+                                || header.outerOffset < valuesEnd || indexEnd > header.fileSize)))
+    {
+        error = cachePath + " is not a valid cache";
+        return false;
+    }
+    if (!StampMatches(header.source, source) || !ReadStampMatches(header.read, read))
+    {
+        error = cachePath + " is stale";
+        return false;
+    }
+
+    char *base = file->Begin();
+    if (header.isSparse
+        && !ValidCsr(reinterpret_cast<const int *>(base + header.outerOffset),
+                     reinterpret_cast<const int *>(base + header.innerOffset), header.rows, header.cols,
+                     header.nonZeros))
+    {
+        error = cachePath + " is not a valid cache";
+        return false;
+    }
+    const char *labels = base + header.labelsOffset;
+    const char *labelsEnd = base + header.rowSumsOffset;
+    matrix.rowLabels.resize(header.rows);
+    matrix.columnLabels.resize(header.cols);
+    for (std::vector<std::string> *list : {&matrix.rowLabels, &matrix.columnLabels})
+    {
+        for (std::string &label : *list)
+        {
+            uint32_t length;
+            if (labels + sizeof(length) > labelsEnd)
+            {
+                error = cachePath + " is not a valid cache";
+                return false;
+            }
+            memcpy(&length, labels, sizeof(length));
+            labels += sizeof(length);
+            if (labels + length > labelsEnd)
+            {
+                error = cachePath + " is not a valid cache";
+                return false;
+            }
+            label.assign(labels, length);
+            labels += length;
+        }
+    }
+
+    matrix.rowSums = Eigen::Map<Eigen::VectorXd>(reinterpret_cast<double *>(base + header.rowSumsOffset), header.rows);
+    matrix.colSums = Eigen::Map<Eigen::VectorXd>(reinterpret_cast<double *>(base + header.colSumsOffset), header.cols);
+
+    matrix.isSparse = header.isSparse != 0;
+    matrix.dense.resize(0, 0);
+    matrix.sparse = CsrMatrix();
+    matrix.mapped.rows = header.rows;
+    matrix.mapped.cols = header.cols;
+    matrix.mapped.nonZeros = header.nonZeros;
+    matrix.mapped.values = reinterpret_cast<double *>(base + header.valuesOffset);
+    matrix.mapped.outer = matrix.isSparse ? reinterpret_cast<int *>(base + header.outerOffset) : nullptr;
+    matrix.mapped.inner = matrix.isSparse ? reinterpret_cast<int *>(base + header.innerOffset) : nullptr;
+    matrix.mapping = file;
+    return true;
+}
@@ -0,0 +1,34 @@
+/* parallel.h
+OpenMP helpers. Everything degrades to a single thread when the code is
+built without -fopenmp.
+*/
+
+#pragma once
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+Number of threads used when none is requested explicitly.
+*/
+inline int DefaultThreadCount()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+/*
+Index of the calling thread inside a parallel region.
+*/
+inline int ThreadIndex()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,297 @@
+/* predictor.h
+Out-of-sample assignment of new rows (or columns) with a saved model (a
+WarmState, see warm_start.h), without the training matrix.
+
+A fit embeds row i as D_r^{-1/2} U, and U = An V Sigma^{-1} with
+An = D_r^{-1/2} A D_c^{-1/2}. A new row a over the training columns, with
+sum r, therefore lands at
+    z = (1 / r) a D_c^{-1/2} V Sigma^{-1}
+over singular pairs 1..k, and takes the label of its nearest centroid. A
+training row projected this way lands on its own embedding when the SVD is
+exact (jacobi, bdc). The randomized SVD only approximates U = An V
+Sigma^{-1}, so there the projection is off by its residual, and a row
+close to the midpoint of two centroids can change label. New columns
+mirror this with D_r^{-1/2} U. For a bistochastic model the row's own
+Sinkhorn scale r = t / (a c) (t the balanced row sum) replaces 1 / sqrt(r)
+in both places, so z = r^{3/2} a diag(c) V Sigma^{-1}.
+
+The projections D_c^{-1/2} V Sigma^{-1} and D_r^{-1/2} U Sigma^{-1} are
+formed once when the predictor is built, so a batch costs one pass over
+its nonzeros (k multiply-adds each) plus a k x k nearest-centroid search
+per item, split over nThreads ranges of rows. PredictAll labels the rows
+and the columns of a row source (streaming.h) in that single pass.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "Eigen/Dense"
+#include "KMeans/KMeans.h"
+#include "adjacency_matrix.h"
+#include "parallel.h"
+#include "warm_start.h"
+
+class CoclusteringPredictor
+{
+public:
+    explicit CoclusteringPredictor(const WarmState &model, int nThreads = DefaultThreadCount())
+        : nThreads(nThreads), columnLabels(model.columnLabels), rowLabels(model.rowLabels),
+          centroids(model.centroids), bistochastic(model.bistochastic), rowScale(model.rowScale),
+          colScale(model.colScale)
+    {
+        int k = model.clusters();
+        Eigen::VectorXd inverse(k);
+        for (int c = 0; c < k; c++)
+        {
+            double sigma = model.singularValues(c + 1);
+            inverse(c) = sigma > 0.0 ? 1.0 / sigma : 0.0;
+        }
+        rowProjection = model.colScale.asDiagonal() * model.V.middleCols(1, k) * inverse.asDiagonal();
+        columnProjection = model.rowScale.asDiagonal() * model.U.middleCols(1, k) * inverse.asDiagonal();
+        trainingRows = model.U.rows();
+        trainingCols = model.V.rows();
+
+        Eigen::Index liveRows = (rowScale.array() > 0.0).count();
+        Eigen::Index liveCols = (colScale.array() > 0.0).count();
+        rowTarget = liveRows > 0 && liveCols > 0 ? sqrt((double) liveCols / (double) liveRows) : 1.0;
+    }
+
+    int clusters() const { return (int) centroids.rows(); }
+
+    /*
+    Training column of each of `labels` (-1 for unknown ones), for inputs
+    whose columns are not in training order.
+    */
+    void MapColumns(const std::vector<std::string> &labels, std::vector<int> &columnMap) const
+    {
+        MatchLabels(columnLabels, trainingCols, labels, (Eigen::Index) labels.size(), columnMap);
+    }
+
+    // Same for the rows of inputs whose new items are columns.
+    void MapRows(const std::vector<std::string> &labels, std::vector<int> &rowMap) const
+    {
+        MatchLabels(rowLabels, trainingRows, labels, (Eigen::Index) labels.size(), rowMap);
+    }
+
+    /*
+    Cluster of every row of A. Column j of A is training column
+    columnMap[j]; unknown columns (-1) are ignored. Rows with nothing in
+    the known columns land at the origin.
+    */
+    void PredictRows(const CsrView &A, const std::vector<int> &columnMap, std::vector<int> &labels)
+    {
+        int N = (int) A.rows();
+        int k = clusters();
+        embedding.resize(N, k);
+        const int *outer = A.outerIndexPtr();
+        const int *inner = A.innerIndexPtr();
+        const double *values = A.valuePtr();
+
+        #pragma omp parallel for schedule(static) num_threads(nThreads)
+        for (int t = 0; t < nThreads; t++)
+        {
+            int begin, end;
+            row_range(N, t, nThreads, begin, end);
+            Eigen::RowVectorXd z(k);
+            for (int i = begin; i < end; i++)
+            {
+                z.setZero();
+                double sum = 0.0;
+                double scaledSum = 0.0;
+                for (int p = outer[i]; p < outer[i + 1]; p++)
+                {
+                    int j = columnMap[inner[p]];
+                    if (j >= 0)
+                    {
+                        z.noalias() += values[p] * rowProjection.row(j);
+                        sum += values[p];
+                        scaledSum += values[p] * colScale(j);
+                    }
+                }
+                z *= EmbedFactor(sum, scaledSum, rowTarget);
+                embedding.row(i) = z.array();
+            }
+        }
+        Assign(labels);
+    }
+
+    /*
+    Cluster of every column of A, whose row i is training row rowMap[i].
+    */
+    void PredictColumns(const CsrView &A, const std::vector<int> &rowMap, std::vector<int> &labels)
+    {
+        int N = (int) A.cols();
+        int k = clusters();
+        embedding.setZero(N, k);
+        Eigen::VectorXd sums = Eigen::VectorXd::Zero(N);
+        Eigen::VectorXd scaledSums = Eigen::VectorXd::Zero(N);
+        const int *outer = A.outerIndexPtr();
+        const int *inner = A.innerIndexPtr();
+        const double *values = A.valuePtr();
+        for (Eigen::Index i = 0; i < A.rows(); i++)
+        {
+            if (rowMap[i] < 0)
+            {
+                continue;
+            }
+            for (int p = outer[i]; p < outer[i + 1]; p++)
+            {
+                embedding.row(inner[p]) += values[p] * columnProjection.row(rowMap[i]).array();
+                sums(inner[p]) += values[p];
+                scaledSums(inner[p]) += values[p] * rowScale(rowMap[i]);
+            }
+        }
+        for (int j = 0; j < N; j++)
+        {
+            embedding.row(j) *= EmbedFactor(sums(j), scaledSums(j), 1.0 / rowTarget);
+        }
+        Assign(labels);
+    }
+
+    /*
+    Cluster of every row and every column of a row source (streaming.h),
+    in one pass over its nonzeros split over the source's ranges. Row i is
+    training row rowMap[i] and column j training column columnMap[j], -1
+    when unknown: rows are embedded through the known columns, columns
+    through the known rows. Columns gather into one partial per range,
+    reduced in range order.
+    */
+    template <typename Source>
+    void PredictAll(const Source &source, const std::vector<int> &rowMap, const std::vector<int> &columnMap,
+                    std::vector<int> &rowClusters, std::vector<int> &columnClusters)
+    {
+        int m = (int) source.rows();
+        int n = (int) source.cols();
+        int k = clusters();
+        int nRanges = source.ranges();
+        embedding.setZero(m, k);
+        Eigen::VectorXd sums = Eigen::VectorXd::Zero(m);
+        Eigen::VectorXd scaledSums = Eigen::VectorXd::Zero(m);
+        columnPartial.resize(nRanges);
+
+        #pragma omp parallel for schedule(static) num_threads(nRanges)
+        for (int t = 0; t < nRanges; t++)
+        {
+            ColumnPartial &part = columnPartial[t];
+            part.embedding.setZero(n, k);
+            part.sums.setZero(n);
+            part.scaledSums.setZero(n);
+            source.VisitRange(t, [&](int i, Eigen::Index j, double v) {
+                int column = columnMap[j];
+                if (column >= 0)
+                {
+                    embedding.row(i) += v * rowProjection.row(column).array();
+                    sums(i) += v;
+                    scaledSums(i) += v * colScale(column);
+                }
+                int row = rowMap[i];
+                if (row >= 0)
+                {
+                    part.embedding.row(j) += v * columnProjection.row(row).array();
+                    part.sums(j) += v;
+                    part.scaledSums(j) += v * rowScale(row);
+                }
+            });
+        }
+        for (int i = 0; i < m; i++)
+        {
+            embedding.row(i) *= EmbedFactor(sums(i), scaledSums(i), rowTarget);
+        }
+        Assign(rowClusters);
+
+        ColumnPartial &total = columnPartial[0];
+        for (int t = 1; t < nRanges; t++)
+        {
+            total.embedding += columnPartial[t].embedding;
+            total.sums += columnPartial[t].sums;
+            total.scaledSums += columnPartial[t].scaledSums;
+        }
+        embedding.swap(total.embedding);
+        for (int j = 0; j < n; j++)
+        {
+            embedding.row(j) *= EmbedFactor(total.sums(j), total.scaledSums(j), 1.0 / rowTarget);
+        }
+        Assign(columnClusters);
+    }
+
+private:
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMatrix;
+
+    // Columns' share of one range of rows in PredictAll.
+    struct ColumnPartial
+    {
+        Eigen::ArrayXXd embedding;
+        Eigen::VectorXd sums;
+        Eigen::VectorXd scaledSums;
+    };
+
+    /*
+    Factor taking an item's projection to its embedding: 1 / (its sum), or
+    (target / scaledSum)^{3/2} for a bistochastic model, where scaledSum is
+    the item dotted with the other side's scales. Empty items stay at the
+    origin.
+    */
+    double EmbedFactor(double sum, double scaledSum, double target) const
+    {
+        if (bistochastic)
+        {
+            double scale = scaledSum > 0.0 ? target / scaledSum : 0.0;
+            return scale * sqrt(scale);
+        }
+        return sum != 0.0 ? 1.0 / sum : 1.0;
+    }
+
+    /*
+    Nearest centroid of every row of `embedding`.
+    */
+    void Assign(std::vector<int> &labels)
+    {
+        int N = (int) embedding.rows();
+        int k = clusters();
+        assignments.resize(N);
+        ExtMat X(embedding.data(), N, k);
+        ExtMat Mu(centroids.data(), k, k);
+        ExtMat Z(assignments.data(), N, 1);
+        AssignRowsFn<double> kernel = fixed_dim_kernel<double>(k);
+        if (kernel != nullptr)
+        {
+            assignClosestFixed(X, Mu, Z, kernel, centroidsBlocked, partialDist, nThreads);
+        }
+        else
+        {
+            distances.resize(N, k);
+            assignClosest(X, Mu, Z, distances, partialDist, nThreads);
+        }
+
+        labels.resize(N);
+        for (int i = 0; i < N; i++)
+        {
+            labels[i] = (int) assignments(i);
+        }
+    }
+
+    int nThreads;
+    std::vector<std::string> columnLabels;
+    std::vector<std::string> rowLabels;
+    Eigen::Index trainingRows = 0;
+    Eigen::Index trainingCols = 0;
+    // Row-major: a batch gathers one row per nonzero.
+    RowMajorMatrix rowProjection;     // D_c^{-1/2} V Sigma^{-1}, cols x k
+    RowMajorMatrix columnProjection;  // D_r^{-1/2} U Sigma^{-1}, rows x k
+    Eigen::ArrayXXd centroids;
+    bool bistochastic;
+    Eigen::VectorXd rowScale;
+    Eigen::VectorXd colScale;
+    double rowTarget = 1.0;  // row sum of a balanced training matrix
+
+    // Batch buffers, reused across calls.
+    Eigen::ArrayXXd embedding;
+    Eigen::ArrayXd assignments;
+    Eigen::ArrayXd centroidsBlocked;
+    Eigen::ArrayXXd distances;
+    std::vector<double> partialDist;
+    std::vector<ColumnPartial> columnPartial;
+};
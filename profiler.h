@@ -0,0 +1,317 @@
+/* profiler.h
+Optional instrumentation: scoped stage timers with peak memory, and
+per-iteration Lloyd statistics, reported as JSON.
+
+Everything is compiled in only with -DSC_PROFILE. Without it the macros
+below expand to nothing, so instrumented code pays no cost at all.
+
+* PROFILE_STAGE(name)                      time the enclosing scope
+* PROFILE_LLOYD_TRACE(trace, Z)            start tracing one k-means run
+* PROFILE_LLOYD_ITERATION(trace, iter, inertia, Z)
+                                           record one iteration
+* PROFILE_LLOYD_DONE(trace, converged)     finish the run
+
+Stages nest per thread. Peak memory is the process high-water mark
+(VmHWM) while the stage was open: it is reset through
+/proc/self/clear_refs when a stage opens, and folded into the enclosing
+stage when it closes. The mark is process-wide, so the reset is skipped
+while a stage is open on another thread (sweep workers, batch jobs,
+k-means restarts): resetting would wipe the peak that stage is recording.
+A stage opened then reports an upper bound, the peak since the last
+reset.
+
+The Lloyd trace records the k-means objective (sum of squared distances
+to the assigned centroids) as returned by the assignment step.
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+#ifdef SC_PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+#include "Eigen/Dense"
+
+class Profiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stage
+    {
+        std::string name;
+        int depth = 0;
+        double start = 0.0;    // seconds since the profiler started
+        double seconds = 0.0;
+        double peakRssMb = 0.0;
+        double rssMb = 0.0;    // resident size when the stage closed
+    };
+
+    struct Iteration
+    {
+        int iteration = 0;
+        double inertia = 0.0;
+        long moved = 0;        // points whose cluster changed
+        double seconds = 0.0;
+    };
+
+    struct LloydRun
+    {
+        int run = 0;
+        int iterations = 0;
+        bool converged = false;
+        std::vector<Iteration> trace;
+    };
+
+    static Profiler &Instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    double Now() const
+    {
+        return std::chrono::duration<double>(Clock::now() - origin).count();
+    }
+
+    void AddStage(const Stage &stage)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stages.push_back(stage);
+    }
+
+    int NextRun()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return nextRun++;
+    }
+
+    void AddLloydRun(LloydRun &run)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lloydRuns.push_back(std::move(run));
+    }
+
+    /*
+    "VmHWM" / "VmRSS" of /proc/self/status in MB, 0 where unavailable.
+    */
+    static double ReadStatusMb(const char *key)
+    {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        size_t length = std::char_traits<char>::length(key);
+        while (std::getline(status, line))
+        {
+            if (line.compare(0, length, key) == 0)
+            {
+                return atof(line.c_str() + length) / 1024.0;
+            }
+        }
+        return 0.0;
+    }
+
+    static void ResetPeakRss()
+    {
+        std::ofstream clear("/proc/self/clear_refs");
+        clear << "5";
+    }
+
+    bool WriteJson(const std::string &path, std::string &error)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream out(path);
+        if (!out)
+        {
+            error = "cannot write " + path;
+            return false;
+        }
+        out << "{\"enabled\": true, \"peak_rss_mb\": " << peakRssMb << ",\n \"stages\": [";
+        for (size_t i = 0; i < stages.size(); i++)
+        {
+            const Stage &s = stages[i];
+            out << (i ? ",\n  " : "\n  ") << "{\"name\": \"" << s.name << "\", \"depth\": " << s.depth
+                << ", \"start\": " << s.start << ", \"seconds\": " << s.seconds
+                << ", \"peak_rss_mb\": " << s.peakRssMb << ", \"rss_mb\": " << s.rssMb << "}";
+        }
+        out << "],\n \"lloyd\": [";
+        for (size_t i = 0; i < lloydRuns.size(); i++)
+        {
+            const LloydRun &r = lloydRuns[i];
+            out << (i ? ",\n  " : "\n  ") << "{\"run\": " << r.run << ", \"iterations\": " << r.iterations
+                << ", \"converged\": " << (r.converged ? "true" : "false") << ", \"trace\": [";
+            for (size_t j = 0; j < r.trace.size(); j++)
+            {
+                const Iteration &it = r.trace[j];
+                out << (j ? ", " : "") << "{\"iteration\": " << it.iteration << ", \"inertia\": " << it.inertia
+                    << ", \"moved\": " << it.moved << ", \"seconds\": " << it.seconds << "}";
+            }
+            out << "]}";
+        }
+        out << "]}\n";
+        return out.good();
+    }
+
+    double peakRssMb = 0.0;  // over every closed top-level stage
+
+private:
+    Profiler() : origin(Clock::now()) {}
+
+    Clock::time_point origin;
+    std::mutex mutex;
+    std::vector<Stage> stages;
+    std::vector<LloydRun> lloydRuns;
+    int nextRun = 0;
+};
+
+/*
+Times its scope as one stage. Stages opened while it is alive (on the same
+thread) are its children.
+*/
+class ScopedStage
+{
+public:
+    explicit ScopedStage(const char *name) : parent(Current())
+    {
+        double hwm = Profiler::ReadStatusMb("VmHWM:");
+        for (ScopedStage *open = parent; open != nullptr; open = open->parent)
+        {
+            open->stage.peakRssMb = std::max(open->stage.peakRssMb, hwm);
+        }
+        stage.name = name;
+        stage.depth = parent ? parent->stage.depth + 1 : 0;
+        // Stages open on this thread are exactly the `depth` ancestors.
+        if (OpenStages()++ == stage.depth)
+        {
+            Profiler::ResetPeakRss();
+        }
+        stage.start = Profiler::Instance().Now();
+        Current() = this;
+    }
+
+    ~ScopedStage()
+    {
+        Profiler &profiler = Profiler::Instance();
+        stage.seconds = profiler.Now() - stage.start;
+        stage.peakRssMb = std::max(stage.peakRssMb, Profiler::ReadStatusMb("VmHWM:"));
+        stage.rssMb = Profiler::ReadStatusMb("VmRSS:");
+        Current() = parent;
+        OpenStages()--;
+        if (parent != nullptr)
+        {
+            parent->stage.peakRssMb = std::max(parent->stage.peakRssMb, stage.peakRssMb);
+        }
+        else
+        {
+            profiler.peakRssMb = std::max(profiler.peakRssMb, stage.peakRssMb);
+        }
+        profiler.AddStage(stage);
+    }
+
+    ScopedStage(const ScopedStage &) = delete;
+    ScopedStage &operator=(const ScopedStage &) = delete;
+
+private:
+    static ScopedStage *&Current()
+    {
+        thread_local ScopedStage *current = nullptr;
+        return current;
+    }
+
+    // Stages open on every thread.
+    static std::atomic<int> &OpenStages()
+    {
+        static std::atomic<int> open(0);
+        return open;
+    }
+
+    Profiler::Stage stage;
+    ScopedStage *parent;
+};
+
+/*
+Per-iteration statistics of one Lloyd run. Keeps a copy of the previous
+assignments to count moved points.
+*/
+class LloydTrace
+{
+public:
+    template <typename Assignments>
+    explicit LloydTrace(const Assignments &Z) : previous(Z.col(0).template cast<double>()), last(Profiler::Instance().Now())
+    {
+        run.run = Profiler::Instance().NextRun();
+    }
+
+    template <typename Assignments>
+    void Iteration(int iteration, double inertia, const Assignments &Z)
+    {
+        double now = Profiler::Instance().Now();
+        Profiler::Iteration it;
+        it.iteration = iteration;
+        it.inertia = inertia;
+        it.moved = (long) (previous != Z.col(0).template cast<double>()).count();
+        it.seconds = now - last;
+        run.trace.push_back(it);
+        run.iterations = iteration + 1;
+        previous = Z.col(0).template cast<double>();
+        last = now;
+    }
+
+    void Finish(bool converged)
+    {
+        run.converged = converged;
+        Profiler::Instance().AddLloydRun(run);
+    }
+
+private:
+    Eigen::ArrayXd previous;
+    double last;
+    Profiler::LloydRun run;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_STAGE(name) ScopedStage PROFILE_CONCAT(profileStage, __LINE__)(name)
+#define PROFILE_LLOYD_TRACE(trace, Z) LloydTrace trace(Z)
+#define PROFILE_LLOYD_ITERATION(trace, iter, inertia, Z) trace.Iteration(iter, inertia, Z)
+#define PROFILE_LLOYD_DONE(trace, converged) trace.Finish(converged)
+
+/*
+Write the collected report to `path`.
+*/
+inline bool WriteProfile(const std::string &path, std::string &error)
+{
+    return Profiler::Instance().WriteJson(path, error);
+}
+
+#else
+
+#define PROFILE_STAGE(name)
+#define PROFILE_LLOYD_TRACE(trace, Z)
+#define PROFILE_LLOYD_ITERATION(trace, iter, inertia, Z)
+#define PROFILE_LLOYD_DONE(trace, converged)
+
+/*
+Without SC_PROFILE there is nothing to report beyond that fact.
+*/
+inline bool WriteProfile(const std::string &path, std::string &error)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        error = "cannot write " + path;
+        return false;
+    }
+    fputs("{\"enabled\": false}\n", file);
+    return fclose(file) == 0;
+}
+
+#endif
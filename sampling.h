@@ -0,0 +1,181 @@
+/* sampling.h
+Row and column sampling for the approximate fit (CoclusteringOptions::
+sampleRate): the model is fitted on the submatrix of a sample of rows and
+columns, and every row and column is then projected onto it (predictor.h)
+in one pass, Nystrom style, so the SVD and k-means never see the full
+matrix.
+
+* SampleIndices : `count` of N items without replacement, uniformly or
+    with probability proportional to a weight (the row or column sums)
+* Submatrix     : the rows x columns submatrix in the input's storage,
+    without the sampled rows and columns it leaves empty
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "Eigen/Dense"
+#include "KMeans/KMeans.h"
+#include "adjacency_matrix.h"
+
+/*
+Indices of `count` of the weights.size() items, ascending, drawn without
+replacement: uniformly, or (byWeight) with the weighted scheme of
+Efraimidis and Spirakis, keeping the largest keys log(u) / weight. Items
+of weight 0 are never drawn by weight, so fewer may be returned.
+*/
+inline void SampleIndices(const Eigen::VectorXd &weights, Eigen::Index count, bool byWeight, mt_state &rng,
+                          std::vector<int> &chosen)
+{
+    Eigen::Index N = weights.size();
+    std::vector<std::pair<double, int>> keys(N);
+    for (Eigen::Index i = 0; i < N; i++)
+    {
+        double u = genrand_double_r(&rng);
+        double key = u;
+        if (byWeight)
+        {
+            key = weights(i) > 0.0 ? std::log(std::max(u, std::numeric_limits<double>::min())) / weights(i)
+                                   : -std::numeric_limits<double>::infinity();
+        }
+        keys[i] = {key, (int) i};
+    }
+    count = std::min(count, N);
+    std::nth_element(keys.begin(), keys.begin() + count, keys.end(),
+                     [](const std::pair<double, int> &a, const std::pair<double, int> &b) { return a > b; });
+
+    chosen.clear();
+    for (Eigen::Index i = 0; i < count; i++)
+    {
+        if (keys[i].first > -std::numeric_limits<double>::infinity())
+        {
+            chosen.push_back(keys[i].second);
+        }
+    }
+    std::sort(chosen.begin(), chosen.end());
+}
+
+/*
+Fill `out` with matrix[rows, cols] (sorted indices) in matrix's storage,
+then drop the columns and rows that are all zero in it; `rows` and `cols`
+are narrowed to the kept ones. Columns go first: dropping an empty column
+changes no row sum, and a row left empty only holds zeros.
+*/
+inline void Submatrix(AdjacencyMatrix &matrix, std::vector<int> &rows, std::vector<int> &cols, AdjacencyMatrix &out)
+{
+    std::vector<int> colIndex(matrix.cols(), -1);
+    for (size_t c = 0; c < cols.size(); c++)
+    {
+        colIndex[cols[c]] = (int) c;
+    }
+
+    // Sums of the submatrix.
+    Eigen::VectorXd rowSums = Eigen::VectorXd::Zero(rows.size());
+    Eigen::VectorXd colSums = Eigen::VectorXd::Zero(cols.size());
+    auto visitRow = [&](int i, auto visit)
+    {
+        if (matrix.isSparse)
+        {
+            CsrView A = matrix.Sparse();
+            for (int p = A.outerIndexPtr()[i]; p < A.outerIndexPtr()[i + 1]; p++)
+            {
+                int c = colIndex[A.innerIndexPtr()[p]];
+                if (c >= 0 && A.valuePtr()[p] != 0.0)
+                {
+                    visit(c, A.valuePtr()[p]);
+                }
+            }
+        }
+        else
+        {
+            DenseView A = matrix.Dense();
+            for (size_t c = 0; c < cols.size(); c++)
+            {
+                if (A(i, cols[c]) != 0.0)
+                {
+                    visit((int) c, A(i, cols[c]));
+                }
+            }
+        }
+    };
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+        visitRow(rows[r], [&](int c, double v) { rowSums(r) += v; colSums(c) += v; });
+    }
+
+    std::vector<int> keptCols;
+    for (size_t c = 0; c < cols.size(); c++)
+    {
+        if (colSums(c) > 0.0)
+        {
+            colIndex[cols[c]] = (int) keptCols.size();
+            keptCols.push_back(cols[c]);
+        }
+        else
+        {
+            colIndex[cols[c]] = -1;
+        }
+    }
+    std::vector<int> keptRows;
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+        if (rowSums(r) > 0.0)
+        {
+            keptRows.push_back(rows[r]);
+        }
+    }
+    rows.swap(keptRows);
+    cols.swap(keptCols);
+
+    out = AdjacencyMatrix();
+    out.isSparse = matrix.isSparse;
+    out.rowLabels.resize(rows.size());
+    out.columnLabels.resize(cols.size());
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+        out.rowLabels[r] = matrix.rowLabels.empty() ? std::to_string(rows[r]) : matrix.rowLabels[rows[r]];
+    }
+    for (size_t c = 0; c < cols.size(); c++)
+    {
+        out.columnLabels[c] = matrix.columnLabels.empty() ? std::to_string(cols[c]) : matrix.columnLabels[cols[c]];
+    }
+
+    if (matrix.isSparse)
+    {
+        std::vector<int> outer(rows.size() + 1, 0);
+        for (size_t r = 0; r < rows.size(); r++)
+        {
+            outer[r + 1] = outer[r];
+            visitRow(rows[r], [&](int, double) { outer[r + 1]++; });
+        }
+        CsrMatrix &sparse = out.sparse;
+        sparse.resize(rows.size(), cols.size());
+        sparse.resizeNonZeros(outer.back());
+        std::copy(outer.begin(), outer.end(), sparse.outerIndexPtr());
+        for (size_t r = 0; r < rows.size(); r++)
+        {
+            int p = outer[r];
+            visitRow(rows[r], [&](int c, double v) {
+                sparse.innerIndexPtr()[p] = c;
+                sparse.valuePtr()[p++] = v;
+            });
+        }
+    }
+    else
+    {
+        DenseView A = matrix.Dense();
+        out.dense.resize(rows.size(), cols.size());
+        for (size_t c = 0; c < cols.size(); c++)
+        {
+            for (size_t r = 0; r < rows.size(); r++)
+            {
+                out.dense(r, c) = A(rows[r], cols[c]);
+            }
+        }
+    }
+}
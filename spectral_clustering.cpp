@@ -1,231 +1,741 @@
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <sstream>
 #include <algorithm>
 #include <vector>
-#include <iterator>
-#include <map>
 #include <math.h>
 #include <numeric>
 
 #include "Eigen/Dense"
-#include "KMeans/KMeans.h"
-
-Eigen::IOFormat CleanFmt(3, 0, " ", "\n", "[", "]");
+#include "adjacency_matrix.h"
+#include "batch.h"
+#include "delimited_reader.h"
+#include "matrix_cache.h"
+#include "predictor.h"
+#include "spectral_coclustering.h"
+#include "triplet_reader.h"
 
 /*
-Check if input CSV file path exists before proceeding.
+Command line options.
 */
-bool FileExists(std::string& name);
+struct Options
+{
+    std::string fileName;
+    std::string cachePath;
+    bool cacheHash = false;
+    ReadOptions read;
+    CoclusteringOptions model;
+    std::string profilePath;
+    std::string precision = "double";
+    int sweepMin = 0;  // sweep k over [sweepMin, sweepMax] when sweepMax > 0
+    int sweepMax = 0;
+    std::string sweepSelect = "eigengap";
+    std::string warmPath;
+    std::string modelPath;    // saved after the fit
+    std::string predictPath;  // model to assign the input's rows (or columns) with
+    bool predictColumns = false;
+    bool streaming = false;   // fit without loading the matrix (streaming.h)
+    size_t maxMemory = 0;     // bytes, 0 = no budget
+    std::string batchPath;    // manifest of jobs run instead of <file> (batch.h)
+};
 
-// ProcessCSV class
 /*
-Split a string into a vector of tokens.
+Parse `[options] <file>`. Returns false on bad input.
+    --sparse-threshold <density>           keep CSR below this density
+    --delimiter <c|tab>                    input delimiter (detected by default)
+    --format <auto|grid|mtx|coo|edges>     input layout, by extension by default
+    --header <auto|yes|no>                 whether the input starts with a header line
+    --threads <n>                          worker threads
+    --clusters <k>                         number of co-clusters
+    --seed <n>                             k-means seed
+    --cache <path>                         binary matrix cache, written on first use
+    --cache-hash                           validate the cache by content hash too
+    --normalize <scale|bistochastic>       one-step scaling or Sinkhorn balancing
+    --sinkhorn-tol <tol>                   bistochastic convergence tolerance
+    --sinkhorn-iters <n>                   max bistochastic iterations
+    --sample <rate>                        fit on this fraction of rows and columns, project the rest
+    --sampling <uniform|degree>            draw the sample uniformly or by row/column sums
+    --svd <randomized|jacobi|bdc>          SVD engine
+    --svd-tol <tol>                        randomized SVD convergence tolerance
+    --svd-oversampling <p>                 extra sketch columns beyond k + 1
+    --svd-iters <n>                        max randomized power iterations
+    --kmeans <lloyd|hamerly|elkan|minibatch>
+                                           k-means iteration scheme
+    --kmeans-tol <tol>                     Lloyd stops at this relative objective change (lloyd only)
+    --kmeans-moved <fraction>              Lloyd stops when at most this fraction moves (lloyd only)
+    --batch-size <n>                       rows per mini-batch step
+    --init <plusplus|random|sampled|scalable>
+                                           k-means initialization
+    --n-init <n>                           k-means restarts, lowest inertia kept
+    --profile-json <path>                  write stage timings and k-means traces
+    --precision <double|float>             working precision after parsing
+    --warm-start <path>                    start from (and update) a saved model state
+    --save-model <path>                    save the fitted model
+    --predict <path>                       label the input's rows with a saved model, no fit
+    --predict-columns                      with --predict, label the input's columns instead
+    --sweep <kmin>:<kmax>                  score every k in the range from one SVD
+    --silhouette-sample <n>                rows + columns scored per k in a sweep
+    --sweep-select <eigengap|silhouette>   score that picks the k whose labels are printed
+    --streaming                            fit out of core, re-reading the input on every SVD pass
+    --max-memory <MB>                      memory budget, checked before allocating; scales in place
+    --batch <manifest>                     co-cluster every job of the manifest concurrently, no <file>
 */
-std::vector<std::string> SplitRow(std::string row, char delimiter='\t');
+bool ParseArguments(int argc, char** argv, Options &options);
 
 /*
-Print elements of a string vector.
+Check if input CSV file path exists before proceeding.
 */
-void PrintRow(std::vector<std::string> row);
+bool FileExists(std::string& name);
 
 /*
-Trim leading and trailing whitespaces from string.
+Co-cluster `matrix` with a Model (SpectralCoclustering or its float
+variant) and print the row and column labels. With a `warmPath`, start
+from the state saved there when it fits the matrix, and save the new one.
 */
-void Trim(std::string &str);
-
-void inverseSqrt(Eigen::VectorXd &vector);
-
-int main(int argc, char** argv)
+template <typename Model>
+bool FitAndPrint(const CoclusteringOptions &options, const std::string &warmPath, const std::string &modelPath,
+                 AdjacencyMatrix &matrix)
 {
-    // Check if the input file exists.
-    std::string fileName(argv[1]);
-    if(!FileExists(fileName))
+    Model model(options);
+    WarmState warm;
+    std::string warmError;
+    if (!warmPath.empty() && ReadWarmState(warmPath, warm, warmError))
     {
-        printf("%s does not exist.\n", fileName.c_str());
-        return 0;
+        model.set_warm_start(&warm);
     }
 
-    // Create column mapping.
-    std::vector<std::string> indexes;
-    std::vector<std::string> columns;
-    auto columnMap = std::map<std::string, std::vector<std::string>>{};
-
-    // Begin reading file.
-    std::ifstream file(argv[1]);
-    std::string fileRow;
-
-    // Record header.
-    if(std::getline(file, fileRow))
+    std::string fitError;
+    if (!model.fit(matrix, fitError))
     {
-        Trim(fileRow);
+        printf("%s\n", fitError.c_str());
+        return false;
+    }
 
-        for (auto & column : SplitRow(fileRow))
+    for (const std::string *path : {&warmPath, &modelPath})
+    {
+        if (!path->empty())
         {
-            columns.push_back(column);
-            std::vector<std::string> newColumn;
-            columnMap.insert(std::make_pair(column, newColumn));
+            model.save_state(matrix, warm);
+            if (!WriteWarmState(*path, warm, warmError))
+            {
+                std::cerr << warmError << '\n';
+            }
         }
     }
 
+    PROFILE_STAGE("write_labels");
+    PrintLabels(std::cout, model.row_labels(), model.column_labels());
+    std::cout.flush();
+    return true;
+}
 
-    // Read remaining file and construct adjacency matrix.
-    std::vector<std::vector<float>> adjacencyMatrixPlaceholder;
-    while (std::getline(file, fileRow))
+/*
+Co-cluster the matrix behind a row source (streaming.h) without loading
+it, and print the row and column labels. With a `budget` (bytes), the fit
+is refused before it starts when the source plus the fit's estimated
+buffers would exceed it.
+*/
+template <typename Model, typename Source>
+bool StreamAndPrint(const CoclusteringOptions &options, const Source &source, size_t budget)
+{
+    Model model(options);
+    if (budget > 0)
     {
-        std::vector<std::string> values = SplitRow(fileRow);
-        std::vector<std::string>::iterator it = values.begin();
-        indexes.push_back(*it);
-        ++it;
-
-        std::vector<float> adjacencyRow;
-        float start = stof(*it);
-
-        float checkZeroSum = 0.0;
-        while (it != values.end())
-        {   
-            float w = stof(*it);
-            checkZeroSum += w;
-            adjacencyRow.push_back(w);
-            columnMap[columns[it - values.begin() - 1]].push_back(*it);
-            ++it;
+        size_t input = source.memory_bytes();
+        size_t fit = model.memory_estimate_streaming(source.rows(), source.cols());
+        std::cerr << "memory: input " << (input >> 20) << " MB + fit " << (fit >> 20) << " MB, budget "
+                  << (budget >> 20) << " MB\n";
+        if (input + fit > budget)
+        {
+            printf("the fit needs about %zu MB, over the %zu MB memory budget\n",
+                   (input + fit + (1 << 20) - 1) >> 20, budget >> 20);
+            return false;
         }
+    }
+    std::string fitError;
+    if (!model.fit_streaming(source, fitError))
+    {
+        printf("%s\n", fitError.c_str());
+        return false;
+    }
 
-        if (checkZeroSum > 0.0){
-            adjacencyMatrixPlaceholder.push_back(adjacencyRow);
-        }
+    PROFILE_STAGE("write_labels");
+    PrintLabels(std::cout, model.row_labels(), model.column_labels());
+    std::cout.flush();
+    return true;
+}
 
+/*
+Streaming counterpart of the load-then-fit path in main(): the cached
+matrix when the cache matches (read in place), else passes over the file.
+*/
+bool StreamInput(const Options &options)
+{
+    SourceStamp sourceStamp;
+    AdjacencyMatrix cachedMatrix;
+    std::string cacheError;
+    ReadStamp readStamp = StampRead(options.read, InputFormat(options.fileName, options.read.format));
+    if (!options.cachePath.empty() && StampSource(options.fileName, options.cacheHash, sourceStamp)
+        && LoadCache(options.cachePath, sourceStamp, readStamp, cachedMatrix, cacheError))
+    {
+        MatrixRows source(cachedMatrix, options.model.nThreads);
+        return options.precision == "float"
+            ? StreamAndPrint<SpectralCoclusteringf>(options.model, source, options.maxMemory)
+            : StreamAndPrint<SpectralCoclustering>(options.model, source, options.maxMemory);
     }
 
-    Eigen::MatrixXd adjacencyMatrix;
-    
-    adjacencyMatrix.resize(adjacencyMatrixPlaceholder.size(), adjacencyMatrixPlaceholder[0].size());
-    
-    for (int i = 0; i < adjacencyMatrixPlaceholder.size(); i++)
+    if (InputFormat(options.fileName, options.read.format) != "grid")
+    {
+        printf("--streaming reads delimited grids only\n");
+        return false;
+    }
+    DelimitedRows source;
     {
-        for (int j = 0; j < adjacencyMatrixPlaceholder[i].size(); j++)
+        PROFILE_STAGE("parse");
+        std::string readError;
+        if (!source.Open(options.fileName, options.read, readError))
         {
-            adjacencyMatrix(i, j) = adjacencyMatrixPlaceholder[i][j];
+            printf("%s\n", readError.c_str());
+            return false;
         }
     }
+    return options.precision == "float"
+        ? StreamAndPrint<SpectralCoclusteringf>(options.model, source, options.maxMemory)
+        : StreamAndPrint<SpectralCoclustering>(options.model, source, options.maxMemory);
+}
 
-    // bistochastic normalize 
-    // => scale normalize
-    // 0. Check sparsity of matrix
-    // 1. Make sure elements nonnegative
-    // 2. Calculated R^(-1/2) and C^(-1/2) efficiently (DONE)
-
+/*
+Report the input's storage and the fit's estimated allocations against
+`budget` bytes on stderr. Returns false, printing why, when they exceed it.
+*/
+template <typename Model>
+bool WithinBudget(const CoclusteringOptions &options, int sweepMin, int sweepMax, const AdjacencyMatrix &matrix,
+                  size_t budget)
+{
+    Model model(options);
+    size_t input = StorageBytes(matrix);
+    size_t fit = sweepMax > 0 ? model.memory_estimate(matrix, sweepMax, sweepMax - sweepMin + 1)
+                              : model.memory_estimate(matrix);
+    std::cerr << "memory: input " << (input >> 20) << " MB + fit " << (fit >> 20) << " MB, budget "
+              << (budget >> 20) << " MB\n";
+    if (input + fit > budget)
+    {
+        printf("the fit needs about %zu MB, over the %zu MB memory budget\n", (input + fit + (1 << 20) - 1) >> 20,
+               budget >> 20);
+        return false;
+    }
+    return true;
+}
 
-    // // normalization
-    Eigen::VectorXd rowSumSqrt = adjacencyMatrix.rowwise().sum();
-    inverseSqrt(rowSumSqrt);
-    rowSumSqrt = (rowSumSqrt.array().isFinite()).select(rowSumSqrt, 0);
-    auto RInv = rowSumSqrt.asDiagonal();
+/*
+Label the rows (or columns) of `matrix` with the model saved at
+`modelPath`, matching the other dimension to the training one by label.
+*/
+bool PredictAndPrint(const std::string &modelPath, bool columns, int nThreads, AdjacencyMatrix &matrix)
+{
+    WarmState model;
+    std::string modelError;
+    if (!ReadWarmState(modelPath, model, modelError))
+    {
+        printf("%s\n", modelError.c_str());
+        return false;
+    }
 
-    Eigen::VectorXd colSumSqrt = adjacencyMatrix.colwise().sum();
-    inverseSqrt(colSumSqrt);
-    colSumSqrt = (colSumSqrt.array().isFinite()).select(colSumSqrt, 0);
-    auto CInv = colSumSqrt.asDiagonal();
+    CsrMatrix owned;
+    if (!matrix.isSparse)
+    {
+        owned = matrix.Dense().sparseView();
+    }
+    CsrView input = matrix.isSparse ? matrix.Sparse()
+                                    : CsrView(owned.rows(), owned.cols(), owned.nonZeros(), owned.outerIndexPtr(),
+                                              owned.innerIndexPtr(), owned.valuePtr());
 
-    Eigen::MatrixXd adjacencyMatrixNorm = RInv * adjacencyMatrix * CInv;
+    CoclusteringPredictor predictor(model, nThreads);
+    std::vector<int> map;
+    std::vector<int> labels;
+    {
+        PROFILE_STAGE("predict");
+        if (columns)
+        {
+            predictor.MapRows(matrix.rowLabels, map);
+            predictor.PredictColumns(input, map, labels);
+        }
+        else
+        {
+            predictor.MapColumns(matrix.columnLabels, map);
+            predictor.PredictRows(input, map, labels);
+        }
+    }
 
-    // singular value decomposition
-    Eigen::JacobiSVD<Eigen::MatrixXd> SVD(adjacencyMatrixNorm, Eigen::ComputeThinU | Eigen::ComputeThinV);
-    Eigen::MatrixXd U = SVD.matrixU();
-    Eigen::MatrixXd V = SVD.matrixV();
+    PROFILE_STAGE("write_labels");
+    const std::vector<int> none;
+    PrintLabels(std::cout, columns ? none : labels, columns ? labels : none);
+    std::cout.flush();
+    return true;
+}
 
-    int clusters = 10;
-    int clusterSize = 800;
-    int nFeatures = 10;
-    int nIters = 1000;
-    int seed = 42;
-    int nExamplesTotal = 4000;
+/*
+Sweep k over [minClusters, maxClusters]: print one line of scores per k,
+then the labels of the k with the highest `select` score.
+*/
+template <typename Model>
+bool SweepAndPrint(const CoclusteringOptions &options, int minClusters, int maxClusters, const std::string &select,
+                   AdjacencyMatrix &matrix)
+{
+    Model model(options);
+    std::vector<SweepResult> results;
+    std::string sweepError;
+    if (!model.sweep(matrix, minClusters, maxClusters, results, sweepError))
+    {
+        printf("%s\n", sweepError.c_str());
+        return false;
+    }
 
-    U = U(Eigen::all, Eigen::seq(1, clusters));
-    V = V(Eigen::all, Eigen::seq(1, clusters));
+    PROFILE_STAGE("write_labels");
+    auto score = [&select](const SweepResult &result)
+    {
+        return select == "silhouette" ? result.silhouette : result.eigengap;
+    };
+    size_t best = 0;
+    for (size_t r = 0; r < results.size(); r++)
+    {
+        const SweepResult &result = results[r];
+        std::cout << "k[" << result.clusters << "] inertia = " << result.inertia << " silhouette = "
+                  << result.silhouette << " eigengap = " << result.eigengap << '\n';
+        if (score(result) > score(results[best]))
+        {
+            best = r;
+        }
+    }
+    std::cout << "best k = " << results[best].clusters << '\n';
 
-    auto ZU = RInv * U;
-    auto ZV = CInv * V;
+    PrintLabels(std::cout, results[best].rowLabels, results[best].columnLabels);
+    std::cout.flush();
+    return true;
+}
 
-    Eigen::MatrixXd Z(ZU.rows() + ZV.rows(), ZU.cols());
-    Z << ZU, ZV;
+/*
+Run the jobs of the manifest at options.batchPath, printing one line per
+job to stdout as it finishes and a summary to stderr. Returns false when
+the manifest is unreadable or a job failed.
+*/
+bool RunManifest(const Options &options)
+{
+    std::vector<BatchJob> jobs;
+    std::string manifestError;
+    if (!ReadManifest(options.batchPath, options.model.clusters, jobs, manifestError))
+    {
+        printf("%s\n", manifestError.c_str());
+        return false;
+    }
 
-    Eigen::ArrayXXd zClusterCentroids = Eigen::ArrayXXd::Zero(clusters, Z.cols());
-    Eigen::ArrayXd zClusterAssigments = Eigen::ArrayXd::Zero(Z.size());
+    auto report = [](const BatchResult &result)
+    {
+        if (result.ok)
+        {
+            std::cout << result.job->input << " -> " << result.job->output << " (" << result.seconds << " s)\n";
+        }
+        else
+        {
+            std::cout << result.job->input << ": " << result.error << '\n';
+        }
+        std::cout.flush();
+    };
+    int failed = options.precision == "float"
+        ? RunBatch<SpectralCoclusteringf>(jobs, options.model, options.read, report)
+        : RunBatch<SpectralCoclustering>(jobs, options.model, options.read, report);
+    std::cerr << "batch: " << jobs.size() - failed << " of " << jobs.size() << " jobs done\n";
+
+    std::string profileError;
+    if (!options.profilePath.empty() && !WriteProfile(options.profilePath, profileError))
+    {
+        std::cerr << profileError << '\n';
+    }
+    return failed == 0;
+}
 
-    RunKMeans(Z.data(), nExamplesTotal, nFeatures, clusters, nIters, seed, strdup("plusplus"), zClusterCentroids.data(), zClusterAssigments.data());
+int main(int argc, char** argv)
+{
+    Options options;
+    if(!ParseArguments(argc, argv, options))
+    {
+        printf("usage: %s [--sparse-threshold <density>] [--delimiter <c|tab>] [--threads <n>]\n"
+               "          [--format auto|grid|mtx|coo|edges] [--header auto|yes|no] [--clusters <k>] [--seed <n>]\n"
+               "          [--cache <path>] [--cache-hash]\n"
+               "          [--normalize scale|bistochastic] [--sinkhorn-tol <tol>] [--sinkhorn-iters <n>]\n"
+               "          [--sample <rate>] [--sampling uniform|degree] [--svd randomized|jacobi|bdc]\n"
+               "          [--svd-tol <tol>] [--svd-oversampling <p>] [--svd-iters <n>]\n"
+               "          [--kmeans lloyd|hamerly|elkan|minibatch] [--batch-size <n>]\n"
+               "          [--kmeans-tol <tol>] [--kmeans-moved <fraction>]\n"
+               "          [--init plusplus|random|sampled|scalable] [--n-init <n>]\n"
+               "          [--profile-json <path>] [--precision double|float] [--warm-start <path>]\n"
+               "          [--save-model <path>] [--predict <path>] [--predict-columns]\n"
+               "          [--sweep <kmin>:<kmax>] [--silhouette-sample <n>]\n"
+               "          [--sweep-select eigengap|silhouette] [--streaming] [--max-memory <MB>]\n"
+               "          <file> | --batch <manifest>\n", argv[0]);
+        return 0;
+    }
 
-    // Assign row clusters
-    auto rowClusterAssignments = std::map<int, int>{};
-    for(int i = 0; i < adjacencyMatrixNorm.rows(); i++)
+    if (!options.batchPath.empty())
     {
-        rowClusterAssignments.insert(std::make_pair(i, zClusterAssigments(i)));
+        RunManifest(options);
+        return 0;
     }
 
-    // Assign column clusters
-    auto colClusterAssignments = std::map<int, int>{};
-    for(int i = 0; i < adjacencyMatrixNorm.cols(); i++)
+    // Check if the input file exists.
+    std::string fileName(options.fileName);
+    if(!FileExists(fileName))
     {
-        colClusterAssignments.insert(std::make_pair(i, zClusterAssigments(adjacencyMatrixNorm.rows() + i)));
+        printf("%s does not exist.\n", fileName.c_str());
+        return 0;
     }
 
-    for (const auto &p : rowClusterAssignments) {
-        std::cout << "row[" << p.first << "] = " << p.second << '\n';
+    if (options.streaming)
+    {
+        if (StreamInput(options))
+        {
+            std::string profileError;
+            if (!options.profilePath.empty() && !WriteProfile(options.profilePath, profileError))
+            {
+                std::cerr << profileError << '\n';
+            }
+        }
+        return 0;
     }
 
-    for (const auto &p : colClusterAssignments) {
-        std::cout << "col[" << p.first << "] = " << p.second << '\n';
+    // Reuse the binary cache when it matches the input and read options, else parse the input.
+    AdjacencyMatrix adjacencyMatrix;
+    SourceStamp sourceStamp;
+    ReadStamp readStamp = StampRead(options.read, InputFormat(fileName, options.read.format));
+    bool stamped = false;
+    bool cached = false;
+    if (!options.cachePath.empty())
+    {
+        PROFILE_STAGE("load_cache");
+        std::string cacheError;
+        stamped = StampSource(fileName, options.cacheHash, sourceStamp);
+        cached = stamped && LoadCache(options.cachePath, sourceStamp, readStamp, adjacencyMatrix, cacheError);
     }
 
-    return 0;
-}
+    // A cache hit is held to the budget the parse it replaces would be.
+    if (cached && options.maxMemory > 0 && MatrixBytes(adjacencyMatrix) > options.maxMemory)
+    {
+        printf("loading %s needs about %zu MB, over the %zu MB memory budget\n", options.cachePath.c_str(),
+               (MatrixBytes(adjacencyMatrix) + (1 << 20) - 1) >> 20, options.maxMemory >> 20);
+        return 0;
+    }
 
+    if (!cached)
+    {
+        {
+            PROFILE_STAGE("parse");
+            std::string readError;
+            if(!ReadMatrix(fileName, options.read, adjacencyMatrix, readError))
+            {
+                printf("%s\n", readError.c_str());
+                return 0;
+            }
+            ComputeSums(adjacencyMatrix);
+        }
 
-bool FileExists(std::string &name)
-{
-    std::ifstream f(name.c_str());
-    return f.good();
-}
+        // Without a stamp the cache could never be matched to its source again.
+        if (stamped)
+        {
+            PROFILE_STAGE("write_cache");
+            std::string cacheError;
+            if (!WriteCache(options.cachePath, adjacencyMatrix, sourceStamp, readStamp, cacheError))
+            {
+                std::cerr << cacheError << '\n';
+            }
+        }
+    }
 
-// ProcessCSV class
-std::vector<std::string> SplitRow(std::string row, char delimiter)
-{
-    std::istringstream stringStream(row);
-    std::string token;
+    if (options.maxMemory > 0 && options.predictPath.empty())
+    {
+        bool fits = options.precision == "float"
+            ? WithinBudget<SpectralCoclusteringf>(options.model, options.sweepMin, options.sweepMax, adjacencyMatrix,
+                                                  options.maxMemory)
+            : WithinBudget<SpectralCoclustering>(options.model, options.sweepMin, options.sweepMax, adjacencyMatrix,
+                                                 options.maxMemory);
+        if (!fits)
+        {
+            return 0;
+        }
+    }
 
-    std::vector<std::string> rowValues;
-    while(std::getline(stringStream, token, delimiter))
+    bool fitted;
+    if (!options.predictPath.empty())
     {
-        rowValues.push_back(token);
+        fitted = PredictAndPrint(options.predictPath, options.predictColumns, options.model.nThreads, adjacencyMatrix);
+    }
+    else if (options.sweepMax > 0)
+    {
+        fitted = options.precision == "float"
+            ? SweepAndPrint<SpectralCoclusteringf>(options.model, options.sweepMin, options.sweepMax,
+                                                   options.sweepSelect, adjacencyMatrix)
+            : SweepAndPrint<SpectralCoclustering>(options.model, options.sweepMin, options.sweepMax,
+                                                  options.sweepSelect, adjacencyMatrix);
+    }
+    else
+    {
+        fitted = options.precision == "float"
+            ? FitAndPrint<SpectralCoclusteringf>(options.model, options.warmPath, options.modelPath, adjacencyMatrix)
+            : FitAndPrint<SpectralCoclustering>(options.model, options.warmPath, options.modelPath, adjacencyMatrix);
+    }
+    if (!fitted)
+    {
+        return 0;
     }
-    return rowValues;
-}
 
-void PrintRow(std::vector<std::string> row)
-{
-    for (auto & entry : row)
+    std::string profileError;
+    if (!options.profilePath.empty() && !WriteProfile(options.profilePath, profileError))
     {
-        std::cout << entry << '\t';
+        std::cerr << profileError << '\n';
     }
+
+    return 0;
 }
 
-void Trim(std::string &str)
+
+bool ParseArguments(int argc, char** argv, Options &options)
 {
-    str.erase(str.begin(), std::find_if(str.begin(), str.end(), [](int ch)
+    for (int i = 1; i < argc; i++)
     {
-        return !std::isspace(ch);
-    }));
-    str.erase(std::find_if(str.rbegin(), str.rend(), [](int ch)
+        std::string arg(argv[i]);
+        if (arg == "--sparse-threshold" && i + 1 < argc)
+        {
+            options.read.sparseThreshold = atof(argv[++i]);
+        }
+        else if (arg == "--delimiter" && i + 1 < argc)
+        {
+            std::string delimiter(argv[++i]);
+            options.read.delimiter = delimiter == "tab" ? '\t' : delimiter[0];
+        }
+        else if (arg == "--format" && i + 1 < argc)
+        {
+            options.read.format = argv[++i];
+            if (options.read.format != "auto" && options.read.format != "grid" && options.read.format != "mtx"
+                && options.read.format != "coo" && options.read.format != "edges")
+            {
+                return false;
+            }
+        }
+        else if (arg == "--header" && i + 1 < argc)
+        {
+            options.read.header = argv[++i];
+            if (options.read.header != "auto" && options.read.header != "yes" && options.read.header != "no")
+            {
+                return false;
+            }
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            options.model.nThreads = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--clusters" && i + 1 < argc)
+        {
+            options.model.clusters = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            options.model.seed = atoi(argv[++i]);
+        }
+        else if (arg == "--cache" && i + 1 < argc)
+        {
+            options.cachePath = argv[++i];
+        }
+        else if (arg == "--cache-hash")
+        {
+            options.cacheHash = true;
+        }
+        else if (arg == "--svd" && i + 1 < argc)
+        {
+            options.model.svd.method = argv[++i];
+            if (options.model.svd.method != "randomized" && options.model.svd.method != "jacobi" && options.model.svd.method != "bdc")
+            {
+                return false;
+            }
+        }
+        else if (arg == "--sample" && i + 1 < argc)
+        {
+            options.model.sampleRate = atof(argv[++i]);
+            if (!(options.model.sampleRate > 0.0 && options.model.sampleRate <= 1.0))
+            {
+                return false;
+            }
+        }
+        else if (arg == "--sampling" && i + 1 < argc)
+        {
+            options.model.sampling = argv[++i];
+            if (options.model.sampling != "uniform" && options.model.sampling != "degree")
+            {
+                return false;
+            }
+        }
+        else if (arg == "--svd-tol" && i + 1 < argc)
+        {
+            options.model.svd.tolerance = atof(argv[++i]);
+        }
+        else if (arg == "--svd-oversampling" && i + 1 < argc)
+        {
+            options.model.svd.oversampling = atoi(argv[++i]);
+            if (options.model.svd.oversampling < 0)
+            {
+                return false;
+            }
+        }
+        else if (arg == "--svd-iters" && i + 1 < argc)
+        {
+            options.model.svd.maxIterations = atoi(argv[++i]);
+            if (options.model.svd.maxIterations < 0)
+            {
+                return false;
+            }
+        }
+        else if (arg == "--kmeans" && i + 1 < argc)
+        {
+            options.model.kmeans = argv[++i];
+            if (options.model.kmeans != "lloyd" && options.model.kmeans != "hamerly" && options.model.kmeans != "elkan"
+                && options.model.kmeans != "minibatch")
+            {
+                return false;
+            }
+        }
+        else if (arg == "--kmeans-tol" && i + 1 < argc)
+        {
+            options.model.kmeansTolerance = std::max(0.0, atof(argv[++i]));
+        }
+        else if (arg == "--kmeans-moved" && i + 1 < argc)
+        {
+            options.model.kmeansMoved = std::max(0.0, atof(argv[++i]));
+        }
+        else if (arg == "--batch-size" && i + 1 < argc)
+        {
+            options.model.batchSize = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--init" && i + 1 < argc)
+        {
+            options.model.init = argv[++i];
+            if (options.model.init != "plusplus" && options.model.init != "random" && options.model.init != "sampled"
+                && options.model.init != "scalable")
+            {
+                return false;
+            }
+        }
+        else if (arg == "--precision" && i + 1 < argc)
+        {
+            options.precision = argv[++i];
+            if (options.precision != "double" && options.precision != "float")
+            {
+                return false;
+            }
+        }
+        else if (arg == "--sweep" && i + 1 < argc)
+        {
+            std::string range(argv[++i]);
+            size_t colon = range.find(':');
+            if (colon == std::string::npos)
+            {
+                return false;
+            }
+            options.sweepMin = atoi(range.substr(0, colon).c_str());
+            options.sweepMax = atoi(range.substr(colon + 1).c_str());
+            if (options.sweepMin < 2 || options.sweepMax < options.sweepMin)
+            {
+                return false;
+            }
+        }
+        else if (arg == "--sweep-select" && i + 1 < argc)
+        {
+            options.sweepSelect = argv[++i];
+            if (options.sweepSelect != "eigengap" && options.sweepSelect != "silhouette")
+            {
+                return false;
+            }
+        }
+        else if (arg == "--silhouette-sample" && i + 1 < argc)
+        {
+            options.model.silhouetteSample = std::max(2, atoi(argv[++i]));
+        }
+        else if (arg == "--warm-start" && i + 1 < argc)
+        {
+            options.warmPath = argv[++i];
+        }
+        else if (arg == "--save-model" && i + 1 < argc)
+        {
+            options.modelPath = argv[++i];
+        }
+        else if (arg == "--predict" && i + 1 < argc)
+        {
+            options.predictPath = argv[++i];
+        }
+        else if (arg == "--predict-columns")
+        {
+            options.predictColumns = true;
+        }
+        else if (arg == "--normalize" && i + 1 < argc)
+        {
+            options.model.normalization = argv[++i];
+            if (options.model.normalization != "scale" && options.model.normalization != "bistochastic")
+            {
+                return false;
+            }
+        }
+        else if (arg == "--sinkhorn-tol" && i + 1 < argc)
+        {
+            options.model.bistochastic.tolerance = atof(argv[++i]);
+        }
+        else if (arg == "--sinkhorn-iters" && i + 1 < argc)
+        {
+            options.model.bistochastic.maxIterations = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--max-memory" && i + 1 < argc)
+        {
+            double megabytes = atof(argv[++i]);
+            if (megabytes <= 0.0)
+            {
+                return false;
+            }
+            options.maxMemory = (size_t) (megabytes * (1 << 20));
+        }
+        else if (arg == "--streaming")
+        {
+            options.streaming = true;
+        }
+        else if (arg == "--batch" && i + 1 < argc)
+        {
+            options.batchPath = argv[++i];
+        }
+        else if (arg == "--profile-json" && i + 1 < argc)
+        {
+            options.profilePath = argv[++i];
+        }
+        else if (arg == "--n-init" && i + 1 < argc)
+        {
+            options.model.nInit = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+        {
+            return false;
+        }
+        else
+        {
+            options.fileName = arg;
+        }
+    }
+    // The tolerances are Lloyd's stopping rule; the other schemes keep their own.
+    if ((options.model.kmeansTolerance > 0.0 || options.model.kmeansMoved > 0.0) && options.model.kmeans != "lloyd")
     {
-        return !std::isspace(ch);
-    }).base(), str.end());
+        return false;
+    }
+    options.read.nThreads = options.model.nThreads;
+    options.read.maxMemory = options.maxMemory;
+    options.model.inPlace = options.maxMemory > 0;
+    return options.fileName.empty() != options.batchPath.empty();
 }
 
-void inverseSqrt(Eigen::VectorXd &vector)
+bool FileExists(std::string &name)
 {
-    for(int i = 0; i < vector.size(); i++)
-    {
-        vector(i) = 1.0f / sqrt(vector(i));
-    }
-}
\ No newline at end of file
+    std::ifstream f(name.c_str());
+    return f.good();
+}
@@ -0,0 +1,934 @@
+/* spectral_coclustering.h
+Spectral co-clustering (Dhillon 2001) as a reusable object.
+
+fit() runs the whole pipeline on an AdjacencyMatrix:
+1. An = D_r^{-1/2} A D_c^{-1/2}, or with normalization = "bistochastic"
+   the Sinkhorn scaling diag(r) A diag(c) (see bistochastic.h)
+2. top k + 1 singular triplets of An; the leading (trivial) pair is dropped
+3. embedding Z = [D_r^{-1/2} U; D_c^{-1/2} V] (square roots of r and c
+   when bistochastic)
+4. k-means on the rows of Z; the first rows() labels are the row clusters,
+   the rest the column clusters
+
+Every intermediate (scaling vectors, normalized matrix, SVD scratch,
+embedding, k-means distances and partial sums) is a member that is only
+resized when the input shape changes. A long-lived instance fitted over
+and over on same-shaped matrices therefore allocates nothing after the
+first fit with the default randomized SVD and the plusplus + lloyd k-means
+path, up to 32 clusters. Past that, the SVD's products and blocked QR (a
+sketch of 48 columns or more) take Eigen scratch on every fit; Lloyd's
+distance product is blocked so that it still does not allocate. Other
+k-means schemes, several restarts and the exact SVD engines keep working
+but take their own scratch on every fit.
+
+The class is templated on the working precision: SpectralCoclustering
+runs in double, SpectralCoclusteringf keeps the normalized matrix, SVD,
+embedding and k-means in float (half the memory, twice the SIMD width).
+The parsed input and the scaling vectors stay double, and objectives are
+accumulated in double either way. In float, k-means schemes other than
+plusplus + lloyd run on a double copy of the embedding.
+
+sweep() scores a range of cluster counts at once. The embedding for k
+clusters is the first k non-trivial singular vectors, so one SVD of rank
+k_max + 1 serves every k: each candidate takes a column prefix of it, and
+the k-means fits run concurrently, one per thread.
+
+fit() can be warm-started from the state of an earlier fit (see
+warm_start.h): the old right singular vectors seed the SVD sketch, and
+the old centroids, rotated onto the new singular basis, seed k-means in
+place of the configured initialization. Cluster ids therefore also carry
+over from run to run.
+
+With options.inPlace, a matrix that owns double storage is scaled in
+place instead of copied, saving the largest buffer of a fit; it then
+holds An and is flagged `scaled`, so it cannot be fitted again.
+memory_estimate() adds up what a fit will allocate, so a memory budget
+can be checked before anything is.
+
+fit_streaming() runs the same pipeline on a row source (streaming.h) for
+inputs larger than memory: the SVD is computed matrix-free over repeated
+passes of the source, so only the O((rows + cols) k) sketches, embedding
+and k-means state are held.
+
+With options.sampleRate below 1, fit() is approximate (Nystrom style):
+it samples that fraction of the rows and of the columns, uniformly or by
+their sums (sampling.h), runs the pipeline on the submatrix, then labels
+every row and column by projecting it onto the sample's singular vectors
+and taking its nearest centroid (predictor.h), in one pass over the
+matrix. Centroids, inertia, singular values and save_state() then
+describe the sample's fit.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Eigen/Dense"
+#include "KMeans/KMeans.h"
+#include "adjacency_matrix.h"
+#include "bistochastic.h"
+#include "parallel.h"
+#include "predictor.h"
+#include "sampling.h"
+#include "profiler.h"
+#include "streaming.h"
+#include "truncated_svd.h"
+#include "warm_start.h"
+
+struct CoclusteringOptions
+{
+    int clusters = 10;
+    int maxIterations = 1000;  // k-means iterations
+    double kmeansTolerance = 0.0;  // Lloyd stops at this relative change of the objective
+    double kmeansMoved = 0.0;      // or when at most this fraction of rows changed cluster (Lloyd only)
+    int seed = 42;             // k-means seed
+    int nThreads = DefaultThreadCount();
+    int nInit = 1;
+    std::string kmeans = "lloyd";
+    std::string init = "plusplus";
+    int batchSize = 1024;
+    SvdOptions svd;
+    std::string normalization = "scale";  // or "bistochastic"
+    BistochasticOptions bistochastic;
+    bool inPlace = false;  // scale an owned double matrix in place instead of copying it
+    int silhouetteSample = 1000;  // rows + columns scored by sweep()
+    double sampleRate = 1.0;  // fraction of rows and of columns fit() fits on, the rest are projected
+    std::string sampling = "uniform";  // or "degree": rows and columns drawn by their sums
+};
+
+/*
+Wall time of each stage of the last fit, in seconds. Several restarts or a
+non-default k-means scheme are reported under kmeansIterations alone.
+*/
+struct FitTimings
+{
+    double sample = 0.0;  // drawing the sample and copying its submatrix
+    double normalize = 0.0;
+    double svd = 0.0;
+    double embed = 0.0;
+    double kmeansInit = 0.0;
+    double kmeansIterations = 0.0;
+    double extend = 0.0;  // projecting every row and column onto the sample's fit
+};
+
+/*
+One candidate of a sweep. Inertia is only comparable between fits of the
+same k (it grows with the embedding dimension); silhouette and eigengap
+compare across k, higher is better for both.
+*/
+struct SweepResult
+{
+    int clusters = 0;
+    double inertia = 0.0;
+    double silhouette = 0.0;  // mean over a sample of rows + columns, in [-1, 1]
+    double eigengap = 0.0;    // sigma_{k-1} - sigma_k of the normalized matrix
+    int iterations = 0;       // Lloyd iterations (0 when another scheme ran)
+    std::vector<int> rowLabels;
+    std::vector<int> columnLabels;
+};
+
+template <typename Scalar>
+class SpectralCoclusteringT
+{
+public:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Dense;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+    typedef Eigen::Array<Scalar, Eigen::Dynamic, Eigen::Dynamic> Array;
+
+    explicit SpectralCoclusteringT(const CoclusteringOptions &options = CoclusteringOptions())
+        : settings(options) {}
+
+    /*
+    Co-cluster `matrix`. Its row/column sums are computed unless already
+    present (e.g. loaded from a cache). Returns false with `error` set when
+    the matrix is too small for the requested number of clusters.
+    */
+    bool fit(AdjacencyMatrix &matrix, std::string &error)
+    {
+        sampledFit = settings.sampleRate < 1.0;
+        if (sampledFit)
+        {
+            return FitSampled(matrix, error);
+        }
+        timings.sample = 0.0;
+        timings.extend = 0.0;
+        return FitMatrix(matrix, error);
+    }
+
+    /*
+    Same as fit(), for a matrix read through a row source (streaming.h)
+    instead of held in memory: the randomized SVD runs on passes over the
+    source and nothing of size rows x cols is ever allocated. Only the
+    randomized SVD can do that; warm starts are not applied.
+    */
+    template <typename Source>
+    bool fit_streaming(const Source &source, std::string &error)
+    {
+        int k = settings.clusters;
+        if (k < 1 || source.rows() < k + 1 || source.cols() < k + 1)
+        {
+            error = "need at least clusters + 1 rows and columns";
+            return false;
+        }
+        if (settings.svd.method != "randomized" || settings.normalization != "scale")
+        {
+            error = "streaming needs the randomized SVD and scale normalization";
+            return false;
+        }
+
+        PROFILE_STAGE("fit");
+        Clock::time_point start = Clock::now();
+        InverseSqrt(source.row_sums(), rowScale);
+        InverseSqrt(source.col_sums(), colScale);
+        timings.normalize = Lap(start);
+        warmStarted = false;
+        svdWork.start.resize(0, 0);
+        {
+            PROFILE_STAGE("svd");
+            RandomizedSvd(StreamingOperator<Source, Scalar>(source, rowScale, colScale), k + 1, settings.svd, svd,
+                          svdWork);
+        }
+        timings.svd = Lap(start);
+        Embed(source.rows(), source.cols(), k, embedding);
+        timings.embed = Lap(start);
+
+        kmeansWork.reserve((int) embedding.rows(), k, k, settings.nThreads);
+        inertiaOut = ClusterRows(embedding, k, settings.nThreads, kmeansWork, rng, centroidsOut, assignments,
+                                iterationsOut, timings.kmeansInit, false);
+        timings.kmeansIterations = Lap(start) - timings.kmeansInit;
+        SplitLabels(assignments, source.rows(), rowLabels, columnLabels);
+        return true;
+    }
+
+    /*
+    Fit every k in [minClusters, maxClusters] from one SVD of rank
+    maxClusters + 1, running the k-means fits concurrently. `results` gets
+    one entry per k, in increasing k. The instance's own labels are left
+    alone; singular_values() and fit_timings() describe the sweep.
+    */
+    bool sweep(AdjacencyMatrix &matrix, int minClusters, int maxClusters, std::vector<SweepResult> &results,
+               std::string &error)
+    {
+        if (minClusters < 2 || maxClusters < minClusters || matrix.rows() < maxClusters + 1
+            || matrix.cols() < maxClusters + 1)
+        {
+            error = "need 2 <= min clusters <= max clusters, and at least max clusters + 1 rows and columns";
+            return false;
+        }
+        if (matrix.scaled)
+        {
+            error = "the matrix was already scaled in place by an earlier fit";
+            return false;
+        }
+
+        PROFILE_STAGE("sweep");
+        Clock::time_point start = Clock::now();
+        Normalize(matrix);
+        timings.normalize = Lap(start);
+        Decompose(matrix, maxClusters + 1);
+        timings.svd = Lap(start);
+        timings.embed = 0.0;
+        timings.kmeansInit = 0.0;
+
+        int N = (int) (matrix.rows() + matrix.cols());
+        int count = maxClusters - minClusters + 1;
+        int nWorkers = std::min(count, settings.nThreads);
+        int innerThreads = count == 1 ? settings.nThreads : 1;
+        workers.resize(nWorkers);
+        results.assign(count, SweepResult());
+
+        // One sample for every k, so the silhouettes compare.
+        int nSample = std::min(N, settings.silhouetteSample);
+        Vec ids(nSample);
+        mt_state sampleRng;
+        init_genrand_r(&sampleRng, settings.seed);
+        select_without_replacement(N, nSample, ids, sampleRng);
+        std::vector<int> sample(ids.data(), ids.data() + nSample);
+        std::sort(sample.begin(), sample.end());
+
+        // Largest k first: they take longest.
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(nWorkers)
+        for (int c = 0; c < count; c++)
+        {
+            int k = maxClusters - c;
+            SweepWorker &worker = workers[nWorkers > 1 ? ThreadIndex() : 0];
+            Embed(matrix.rows(), matrix.cols(), k, worker.embedding);
+            worker.ws.reserve(N, k, k, innerThreads);
+
+            SweepResult &result = results[k - minClusters];
+            double initSeconds;
+            result.clusters = k;
+            result.inertia = ClusterRows(worker.embedding, k, innerThreads, worker.ws, worker.rng, worker.centroids,
+                                         worker.assignments, result.iterations, initSeconds, false);
+            result.silhouette = SampledSilhouette(worker.embedding, worker.assignments, k, sample);
+            result.eigengap = (double) svd.singularValues(k - 1) - (double) svd.singularValues(k);
+            SplitLabels(worker.assignments, matrix.rows(), result.rowLabels, result.columnLabels);
+        }
+        timings.kmeansIterations = Lap(start);
+        return true;
+    }
+
+    const std::vector<int> &row_labels() const { return rowLabels; }
+    const std::vector<int> &column_labels() const { return columnLabels; }
+
+    // k x k centroids in the embedding space.
+    const Array &centroids() const { return centroidsOut; }
+    // Singular values 0..k of the normalized matrix (0 is the trivial one).
+    const Vector &singular_values() const { return svd.singularValues; }
+    // k-means objective of the returned labels.
+    double inertia() const { return inertiaOut; }
+    const FitTimings &fit_timings() const { return timings; }
+    // Lloyd iterations of the last fit (0 when another scheme ran).
+    int iterations() const { return iterationsOut; }
+
+    const CoclusteringOptions &options() const { return settings; }
+    // Cluster count of later fits; the workspaces are kept.
+    void set_clusters(int k) { settings.clusters = k; }
+
+    // Sinkhorn iterations of the last fit (0 with scale normalization).
+    int normalize_iterations() const { return normalizeIterations; }
+    // Randomized SVD power iterations of the last fit.
+    int svd_iterations() const { return svd.iterations; }
+    // Whether the last fit started from the warm-start state.
+    bool warm_started() const { return warmStarted; }
+
+    /*
+    Seed later fits with `state`, saved by save_state() after an earlier
+    fit. It is used when it has the same number of clusters and shares
+    more than clusters rows and columns (by label) with the matrix;
+    otherwise the fit starts cold. The state must outlive the fits;
+    nullptr turns warm starts off.
+    */
+    void set_warm_start(const WarmState *state) { warm = state; }
+
+    /*
+    State of the last fit, which was on `matrix` (of its sample, after an
+    approximate fit).
+    */
+    void save_state(const AdjacencyMatrix &matrix, WarmState &state) const
+    {
+        const AdjacencyMatrix &fitted = sampledFit ? sampledMatrix : matrix;
+        state.rowLabels = fitted.rowLabels;
+        state.columnLabels = fitted.columnLabels;
+        state.singularValues = svd.singularValues.template cast<double>();
+        state.bistochastic = settings.normalization == "bistochastic";
+        state.rowScale = rowScale;
+        state.colScale = colScale;
+        state.U = svd.U.template cast<double>();
+        state.V = svd.V.template cast<double>();
+        state.centroids = centroidsOut.template cast<double>();
+    }
+
+    /*
+    Estimated bytes a fit of `matrix` allocates on top of the matrix itself
+    with the current options, for checking a memory budget up front: the
+    scaled copy (none when scaled in place), Sinkhorn scratch, SVD sketches
+    and factors, embedding, k-means scratch and labels. With `sweepMax`, a
+    sweep up to that many clusters, `sweepCount` k-means fits of which run
+    at once. An approximate fit counts its sample (the stored entries
+    scaled by the sampled share) plus the projection buffers. Small k x k
+    and per-thread buffers are left out.
+    */
+    size_t memory_estimate(const AdjacencyMatrix &matrix, int sweepMax = 0, int sweepCount = 1) const
+    {
+        const size_t s = sizeof(Scalar);
+        bool sampled = settings.sampleRate < 1.0 && sweepMax == 0;
+        size_t m = (size_t) (sampled ? SampleCount(matrix.rows()) : matrix.rows());
+        size_t n = (size_t) (sampled ? SampleCount(matrix.cols()) : matrix.cols());
+        size_t N = m + n;
+        size_t k = (size_t) (sweepMax > 0 ? sweepMax : settings.clusters);
+        size_t rank = k + 1;
+
+        size_t stored = matrix.isSparse ? (size_t) (matrix.IsMapped() ? matrix.mapped.nonZeros
+                                                                      : matrix.sparse.nonZeros())
+                                        : m * n;
+        size_t bytes = sizeof(double) * N;
+        if (sampled)
+        {
+            if (matrix.isSparse)
+            {
+                stored = (size_t) ((double) stored * m * n / ((double) matrix.rows() * matrix.cols()));
+            }
+            bytes += stored * (sizeof(double) + (matrix.isSparse ? sizeof(int) : 0));
+            bytes += sizeof(double) * (matrix.rows() * k + (size_t) settings.nThreads * matrix.cols() * (k + 2));
+        }
+        bool inPlace = sampled ? settings.inPlace && std::is_same<Scalar, double>::value : InPlace(matrix);
+        if (!inPlace)
+        {
+            bytes += s * stored;
+        }
+        if (settings.normalization == "bistochastic")
+        {
+            bytes += sizeof(double) * (m + (size_t) settings.nThreads * n);
+        }
+        if (settings.svd.method == "randomized")
+        {
+            // omega, W and its QR copy (n x l); Q and its QR copy (m x l); U, V.
+            size_t l = std::min(rank + (size_t) std::max(settings.svd.oversampling, 0), std::min(m, n));
+            bytes += s * (l * (2 * m + 3 * n) + rank * N);
+        }
+        else
+        {
+            // A dense copy (and the densified sparse input), thin factors.
+            bytes += s * (m * n * (matrix.isSparse ? 2 : 1) + std::min(m, n) * N);
+        }
+
+        size_t fits = sweepMax > 0 ? (size_t) std::max(1, std::min(sweepCount, settings.nThreads)) : 1;
+        return bytes + fits * KMeansBytes(N, k) + sizeof(int) * N;
+    }
+
+    /*
+    Same for fit_streaming() on a rows x cols source: the scales, the
+    randomized SVD's sketches and factors, the per-range partials of its
+    transposed products, and the k-means fit. The source's own memory is
+    not included.
+    */
+    size_t memory_estimate_streaming(Eigen::Index rows, Eigen::Index cols) const
+    {
+        const size_t s = sizeof(Scalar);
+        size_t m = (size_t) rows;
+        size_t n = (size_t) cols;
+        size_t N = m + n;
+        size_t k = (size_t) settings.clusters;
+        size_t l = std::min(k + 1 + (size_t) std::max(settings.svd.oversampling, 0), std::min(m, n));
+        size_t bytes = sizeof(double) * N;
+        bytes += s * (l * (2 * m + 3 * n) + (k + 1) * N);
+        bytes += s * (size_t) settings.nThreads * n * l;
+        return bytes + KMeansBytes(N, k) + sizeof(int) * N;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    /*
+    Bytes of one k-means fit of N points in k dimensions: embedding,
+    labels, nearest / current distances, sampler, and the N x k distances
+    when k has no fixed-dimension kernel.
+    */
+    size_t KMeansBytes(size_t N, size_t k) const
+    {
+        const size_t s = sizeof(Scalar);
+        size_t bytes = s * N * (k + 3) + sizeof(double) * N;
+        if (k > (size_t) FixedDimMax)
+        {
+            bytes += s * N * k;
+        }
+        if (settings.kmeans != "lloyd" || settings.init != "plusplus" || settings.nInit > 1)
+        {
+            // Other schemes: their own distances or bounds and labels in
+            // double, for every restart running at once.
+            size_t restarts = (size_t) std::max(1, std::min(settings.nInit, settings.nThreads));
+            bytes += restarts * sizeof(double) * N * (2 * k + 1);
+        }
+        return bytes;
+    }
+    typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Labels;
+
+    // Buffers of one concurrent k-means fit in sweep().
+    struct SweepWorker
+    {
+        Dense embedding;
+        Array centroids;
+        Labels assignments;
+        KMeansWorkspaceT<Scalar> ws;
+        mt_state rng;
+    };
+
+    /*
+    The pipeline of fit() on `matrix` itself.
+    */
+    bool FitMatrix(AdjacencyMatrix &matrix, std::string &error)
+    {
+        int k = settings.clusters;
+        if (k < 1 || matrix.rows() < k + 1 || matrix.cols() < k + 1)
+        {
+            error = "need at least clusters + 1 rows and columns";
+            return false;
+        }
+        if (matrix.scaled)
+        {
+            error = "the matrix was already scaled in place by an earlier fit";
+            return false;
+        }
+
+        PROFILE_STAGE("fit");
+        Clock::time_point start = Clock::now();
+        Normalize(matrix);
+        timings.normalize = Lap(start);
+        warmStarted = PrepareWarmStart(matrix, k);
+        Decompose(matrix, k + 1);
+        timings.svd = Lap(start);
+        Embed(matrix.rows(), matrix.cols(), k, embedding);
+        timings.embed = Lap(start);
+
+        if (warmStarted)
+        {
+            AlignWarmCentroids(matrix.rows(), matrix.cols(), k);
+        }
+        kmeansWork.reserve((int) embedding.rows(), k, k, settings.nThreads);
+        inertiaOut = ClusterRows(embedding, k, settings.nThreads, kmeansWork, rng, centroidsOut, assignments,
+                                iterationsOut, timings.kmeansInit, warmStarted);
+        timings.kmeansIterations = Lap(start) - timings.kmeansInit;
+        SplitLabels(assignments, matrix.rows(), rowLabels, columnLabels);
+        return true;
+    }
+
+    /*
+    Rows (or columns) of a sample out of `total`: sampleRate of them, but
+    at least clusters + 1.
+    */
+    Eigen::Index SampleCount(Eigen::Index total) const
+    {
+        Eigen::Index count = (Eigen::Index) std::ceil(settings.sampleRate * (double) total);
+        return std::min(total, std::max(count, (Eigen::Index) settings.clusters + 1));
+    }
+
+    /*
+    fit() on a sample: draw it, fit its submatrix, then project every row
+    and column of `matrix` onto that fit in one pass.
+    */
+    bool FitSampled(AdjacencyMatrix &matrix, std::string &error)
+    {
+        if (matrix.scaled)
+        {
+            error = "the matrix was already scaled in place by an earlier fit";
+            return false;
+        }
+
+        PROFILE_STAGE("fit_sampled");
+        Clock::time_point start = Clock::now();
+        {
+            PROFILE_STAGE("sample");
+            ComputeSums(matrix);
+            mt_state sampleRng;
+            init_genrand_r(&sampleRng, settings.seed);
+            bool byDegree = settings.sampling == "degree";
+            SampleIndices(matrix.rowSums, SampleCount(matrix.rows()), byDegree, sampleRng, sampledRows);
+            SampleIndices(matrix.colSums, SampleCount(matrix.cols()), byDegree, sampleRng, sampledColumns);
+            Submatrix(matrix, sampledRows, sampledColumns, sampledMatrix);
+        }
+        double sampleSeconds = Lap(start);
+        if (!FitMatrix(sampledMatrix, error))
+        {
+            return false;
+        }
+        timings.sample = sampleSeconds;
+
+        start = Clock::now();
+        {
+            PROFILE_STAGE("extend");
+            save_state(sampledMatrix, sampledState);
+            CoclusteringPredictor predictor(sampledState, settings.nThreads);
+            std::vector<int> rowMap(matrix.rows(), -1);
+            std::vector<int> columnMap(matrix.cols(), -1);
+            for (size_t r = 0; r < sampledRows.size(); r++)
+            {
+                rowMap[sampledRows[r]] = (int) r;
+            }
+            for (size_t c = 0; c < sampledColumns.size(); c++)
+            {
+                columnMap[sampledColumns[c]] = (int) c;
+            }
+            MatrixRows source(matrix, settings.nThreads);
+            predictor.PredictAll(source, rowMap, columnMap, rowLabels, columnLabels);
+        }
+        timings.extend = Lap(start);
+        return true;
+    }
+
+    /*
+    Seconds since `start`, then restart the lap.
+    */
+    static double Lap(Clock::time_point &start)
+    {
+        Clock::time_point now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - start).count();
+        start = now;
+        return seconds;
+    }
+
+    /*
+    1 / sqrt(sums), with zero sums mapped to 0 instead of infinity.
+    */
+    static void InverseSqrt(const Eigen::VectorXd &sums, Eigen::VectorXd &scale)
+    {
+        scale.resize(sums.size());
+        for (Eigen::Index i = 0; i < sums.size(); i++)
+        {
+            double value = 1.0 / sqrt(sums(i));
+            scale(i) = std::isfinite(value) ? value : 0.0;
+        }
+    }
+
+    /*
+    Scaling vectors (D_r^{-1/2} and D_c^{-1/2}, or the bistochastic ones),
+    and the scaled matrix into the instance's buffers.
+    */
+    void Normalize(AdjacencyMatrix &matrix)
+    {
+        PROFILE_STAGE("normalize");
+        ComputeSums(matrix);
+        if (settings.normalization == "bistochastic")
+        {
+            normalizeIterations = Bistochastic(matrix, settings.bistochastic, settings.nThreads, rowScale, colScale,
+                                               bistochasticWork);
+        }
+        else
+        {
+            InverseSqrt(matrix.rowSums, rowScale);
+            InverseSqrt(matrix.colSums, colScale);
+            normalizeIterations = 0;
+        }
+
+        scaledInPlace = InPlace(matrix);
+        if (scaledInPlace)
+        {
+            if (matrix.isSparse)
+            {
+                ScaleInPlace(matrix.Sparse(), rowScale, colScale);
+            }
+            else
+            {
+                DenseView dense = matrix.Dense();
+                dense.array().colwise() *= rowScale.array();
+                dense.array().rowwise() *= colScale.transpose().array();
+            }
+            matrix.scaled = true;
+            normalizedValues.resize(0);
+            normalizedDense.resize(0, 0);
+        }
+        else if (matrix.isSparse)
+        {
+            CsrView input = matrix.Sparse();
+            normalizedValues.resize(input.nonZeros());
+            ScaleValues(input, rowScale, colScale, normalizedValues.data());
+        }
+        else
+        {
+            normalizedDense.resize(matrix.rows(), matrix.cols());
+            normalizedDense.noalias() =
+                (rowScale.asDiagonal() * matrix.Dense() * colScale.asDiagonal()).template cast<Scalar>();
+        }
+    }
+
+    /*
+    Match the warm-start state to `matrix` and put its right singular
+    vectors at the head of the SVD sketch (zero rows for new columns).
+    Returns false, leaving a cold start, when there is no usable state.
+    */
+    bool PrepareWarmStart(const AdjacencyMatrix &matrix, int k)
+    {
+        bool usable = warm != nullptr && warm->clusters() == k && warm->V.cols() == k + 1
+            && MatchLabels(warm->rowLabels, warm->U.rows(), matrix.rowLabels, matrix.rows(), previousRow) > k
+            && MatchLabels(warm->columnLabels, warm->V.rows(), matrix.columnLabels, matrix.cols(), previousColumn) > k;
+        if (!usable)
+        {
+            if (svdWork.start.size() > 0)
+            {
+                svdWork.start.resize(0, 0);
+            }
+            return false;
+        }
+
+        svdWork.start.setZero(matrix.cols(), k + 1);
+        for (Eigen::Index j = 0; j < matrix.cols(); j++)
+        {
+            if (previousColumn[j] >= 0)
+            {
+                svdWork.start.row(j) = warm->V.row(previousColumn[j]).template cast<Scalar>();
+            }
+        }
+        return true;
+    }
+
+    /*
+    Old centroids in the new embedding's coordinates. Singular vectors are
+    only defined up to sign (and rotation within near-equal singular
+    values), so the orthogonal R that best maps the new vectors 1..k onto
+    the old ones over the shared rows and columns is found (Procrustes:
+    R = P Q^T for new^T old = P S Q^T), and the centroids become Mu R^T.
+    */
+    void AlignWarmCentroids(Eigen::Index rows, Eigen::Index cols, int k)
+    {
+        Eigen::MatrixXd cross = Eigen::MatrixXd::Zero(k, k);
+        for (Eigen::Index i = 0; i < rows; i++)
+        {
+            if (previousRow[i] >= 0)
+            {
+                cross.noalias() += svd.U.row(i).segment(1, k).transpose().template cast<double>()
+                    * warm->U.row(previousRow[i]).segment(1, k);
+            }
+        }
+        for (Eigen::Index j = 0; j < cols; j++)
+        {
+            if (previousColumn[j] >= 0)
+            {
+                cross.noalias() += svd.V.row(j).segment(1, k).transpose().template cast<double>()
+                    * warm->V.row(previousColumn[j]).segment(1, k);
+            }
+        }
+        Eigen::JacobiSVD<Eigen::MatrixXd> polar(cross, Eigen::ComputeFullU | Eigen::ComputeFullV);
+        Eigen::MatrixXd rotation = polar.matrixU() * polar.matrixV().transpose();
+        centroidsOut = (warm->centroids.matrix() * rotation.transpose()).array().template cast<Scalar>();
+    }
+
+    /*
+    Whether Normalize() scales `matrix` itself: asked for, and the matrix
+    owns double storage the working precision can use as is.
+    */
+    bool InPlace(const AdjacencyMatrix &matrix) const
+    {
+        return settings.inPlace && std::is_same<Scalar, double>::value && !matrix.IsMapped();
+    }
+
+    /*
+    Top k + 1 singular triplets of the normalized matrix. A sparse input
+    shares its index arrays with the normalized values.
+    */
+    void Decompose(AdjacencyMatrix &matrix, int rank)
+    {
+        PROFILE_STAGE("svd");
+        if (matrix.isSparse)
+        {
+            CsrView input = matrix.Sparse();
+            Scalar *values = normalizedValues.data();
+            if constexpr (std::is_same<Scalar, double>::value)
+            {
+                values = scaledInPlace ? input.valuePtr() : values;
+            }
+            CsrViewT<Scalar> normalized(input.rows(), input.cols(), input.nonZeros(),
+                                        const_cast<int *>(input.outerIndexPtr()),
+                                        const_cast<int *>(input.innerIndexPtr()), values);
+            ComputeSvd(normalized, rank, settings.svd, svd, svdWork);
+            return;
+        }
+        if constexpr (std::is_same<Scalar, double>::value)
+        {
+            if (scaledInPlace)
+            {
+                ComputeSvd(matrix.Dense(), rank, settings.svd, svd, svdWork);
+                return;
+            }
+        }
+        ComputeSvd(normalizedDense, rank, settings.svd, svd, svdWork);
+    }
+
+    /*
+    Z = [D_r^{-1/2} U; D_c^{-1/2} V] over singular pairs 1..k, i.e. without
+    the leading one. Bistochastic scales behave like D^{-1} rather than
+    D^{-1/2}, so their square roots take that place.
+    */
+    void Embed(Eigen::Index rows, Eigen::Index cols, int k, Dense &Z) const
+    {
+        PROFILE_STAGE("embed");
+        Z.resize(rows + cols, k);
+        if (settings.normalization == "bistochastic")
+        {
+            Z.topRows(rows).noalias() =
+                rowScale.cwiseSqrt().template cast<Scalar>().asDiagonal() * svd.U.middleCols(1, k);
+            Z.bottomRows(cols).noalias() =
+                colScale.cwiseSqrt().template cast<Scalar>().asDiagonal() * svd.V.middleCols(1, k);
+        }
+        else
+        {
+            Z.topRows(rows).noalias() = rowScale.template cast<Scalar>().asDiagonal() * svd.U.middleCols(1, k);
+            Z.bottomRows(cols).noalias() = colScale.template cast<Scalar>().asDiagonal() * svd.V.middleCols(1, k);
+        }
+    }
+
+    /*
+    k-means on the rows of X with the configured scheme, `nThreads` wide.
+    Fills Mu and Z and returns the inertia. `iterations` gets the Lloyd
+    iteration count (0 for other schemes), `initSeconds` the time spent
+    placing the initial centroids (0 unless plusplus + lloyd, where it is
+    not part of the iterations). With `seeded`, Mu already holds the
+    initial centroids and a single run starts from them.
+    */
+    double ClusterRows(Dense &embedded, int k, int nThreads, KMeansWorkspaceT<Scalar> &ws, mt_state &state,
+                       Array &centroids, Labels &labels, int &iterations, double &initSeconds, bool seeded) const
+    {
+        int N = (int) embedded.rows();
+        centroids.resize(k, k);
+        labels.resize(N);
+        initSeconds = 0.0;
+        iterations = 0;
+
+        if (seeded)
+        {
+            PROFILE_STAGE("kmeans_iterations");
+            init_genrand_r(&state, settings.seed);
+            if (settings.kmeans == "lloyd")
+            {
+                ExtMatT<Scalar> X(embedded.data(), N, k);
+                ExtMatT<Scalar> Mu(centroids.data(), k, k);
+                ExtMatT<Scalar> Z(labels.data(), N, 1);
+                iterations = run_lloyd(X, Mu, Z, settings.maxIterations, ws, nThreads, settings.kmeansTolerance,
+                                       settings.kmeansMoved);
+                return calc_inertia(X, Mu, Z, ws.partialDist, nThreads);
+            }
+            // The other schemes run in double.
+            Eigen::ArrayXXd X = embedded.template cast<double>();
+            Eigen::ArrayXXd Mu = centroids.template cast<double>();
+            Eigen::ArrayXXd Z(N, 1);
+            ExtMat XMap(X.data(), N, k);
+            ExtMat MuMap(Mu.data(), k, k);
+            ExtMat ZMap(Z.data(), N, 1);
+            run_kmeans(XMap, MuMap, ZMap, settings.maxIterations, settings.kmeans.c_str(), state, nThreads,
+                       settings.batchSize, settings.kmeansTolerance, settings.kmeansMoved);
+            centroids = Mu.cast<Scalar>();
+            labels = Z.col(0).cast<Scalar>();
+            return calc_inertia(XMap, MuMap, ZMap, nThreads);
+        }
+        else if (settings.nInit == 1 && settings.kmeans == "lloyd" && settings.init == "plusplus")
+        {
+            // Same draws as RunKMeans, on the caller's buffers.
+            Clock::time_point start = Clock::now();
+            ExtMatT<Scalar> X(embedded.data(), N, k);
+            ExtMatT<Scalar> Mu(centroids.data(), k, k);
+            ExtMatT<Scalar> Z(labels.data(), N, 1);
+            init_genrand_r(&state, settings.seed);
+            {
+                PROFILE_STAGE("kmeans_init");
+                sampleRowsPlusPlus(X, Mu, state, ws);
+            }
+            initSeconds = Lap(start);
+            PROFILE_STAGE("kmeans_iterations");
+            iterations = run_lloyd(X, Mu, Z, settings.maxIterations, ws, nThreads, settings.kmeansTolerance,
+                                   settings.kmeansMoved);
+            return calc_inertia(X, Mu, Z, ws.partialDist, nThreads);
+        }
+        else if constexpr (std::is_same<Scalar, double>::value)
+        {
+            return RunKMeansMultiRestart(embedded.data(), N, k, k, settings.maxIterations, settings.seed,
+                                         settings.init.c_str(), centroids.data(), labels.data(), settings.nInit,
+                                         nThreads, settings.kmeans.c_str(), settings.batchSize,
+                                         settings.kmeansTolerance, settings.kmeansMoved);
+        }
+        else
+        {
+            Eigen::MatrixXd X = embedded.template cast<double>();
+            Eigen::ArrayXXd Mu(k, k);
+            Eigen::ArrayXd Z(N);
+            double inertia = RunKMeansMultiRestart(X.data(), N, k, k, settings.maxIterations, settings.seed,
+                                                   settings.init.c_str(), Mu.data(), Z.data(), settings.nInit,
+                                                   nThreads, settings.kmeans.c_str(), settings.batchSize,
+                                                   settings.kmeansTolerance, settings.kmeansMoved);
+            centroids = Mu.cast<Scalar>();
+            labels = Z.cast<Scalar>();
+            return inertia;
+        }
+    }
+
+    /*
+    First `rows` labels to the row clusters, the rest to the columns.
+    */
+    static void SplitLabels(const Labels &labels, Eigen::Index rows, std::vector<int> &rowOut,
+                            std::vector<int> &columnOut)
+    {
+        rowOut.resize(rows);
+        columnOut.resize(labels.size() - rows);
+        for (Eigen::Index i = 0; i < rows; i++)
+        {
+            rowOut[i] = (int) labels(i);
+        }
+        for (size_t j = 0; j < columnOut.size(); j++)
+        {
+            columnOut[j] = (int) labels(rows + j);
+        }
+    }
+
+    /*
+    Mean silhouette of the `sample` rows of X, measured against the other
+    sampled rows only. Rows alone in their cluster (within the sample)
+    score 0.
+    */
+    static double SampledSilhouette(const Dense &X, const Labels &labels, int k, const std::vector<int> &sample)
+    {
+        int S = (int) sample.size();
+        Eigen::MatrixXd points(S, X.cols());
+        std::vector<int> cluster(S);
+        std::vector<int> counts(k, 0);
+        for (int a = 0; a < S; a++)
+        {
+            points.row(a) = X.row(sample[a]).template cast<double>();
+            cluster[a] = (int) labels(sample[a]);
+            counts[cluster[a]]++;
+        }
+
+        std::vector<double> sums(k);
+        double total = 0.0;
+        for (int a = 0; a < S; a++)
+        {
+            if (counts[cluster[a]] < 2)
+            {
+                continue;
+            }
+            std::fill(sums.begin(), sums.end(), 0.0);
+            for (int b = 0; b < S; b++)
+            {
+                sums[cluster[b]] += (points.row(a) - points.row(b)).norm();
+            }
+            double within = sums[cluster[a]] / (counts[cluster[a]] - 1);
+            double nearest = std::numeric_limits<double>::infinity();
+            for (int c = 0; c < k; c++)
+            {
+                if (c != cluster[a] && counts[c] > 0)
+                {
+                    nearest = std::min(nearest, sums[c] / counts[c]);
+                }
+            }
+            double scale = std::max(within, nearest);
+            if (std::isfinite(nearest) && scale > 0.0)
+            {
+                total += (nearest - within) / scale;
+            }
+        }
+        return S > 0 ? total / S : 0.0;
+    }
+
+    CoclusteringOptions settings;
+
+    // Workspaces, reused across fits.
+    Eigen::VectorXd rowScale;
+    Eigen::VectorXd colScale;
+    BistochasticWorkspace bistochasticWork;
+    Dense normalizedDense;
+    Vector normalizedValues;
+    SvdWorkspaceT<Scalar> svdWork;
+    TruncatedSvdT<Scalar> svd;
+    Dense embedding;
+    Labels assignments;
+    KMeansWorkspaceT<Scalar> kmeansWork;
+    mt_state rng;
+    std::vector<SweepWorker> workers;
+    const WarmState *warm = nullptr;
+    std::vector<int> previousRow;     // warm-start index of each row, -1 if new
+    std::vector<int> previousColumn;
+
+    // Results.
+    Array centroidsOut;
+    std::vector<int> rowLabels;
+    std::vector<int> columnLabels;
+    double inertiaOut = 0.0;
+    int iterationsOut = 0;
+    int normalizeIterations = 0;
+    bool scaledInPlace = false;
+    bool warmStarted = false;
+    FitTimings timings;
+
+    // Approximate fits: the sample, its submatrix and the state projected onto.
+    bool sampledFit = false;
+    std::vector<int> sampledRows;
+    std::vector<int> sampledColumns;
+    AdjacencyMatrix sampledMatrix;
+    WarmState sampledState;
+};
+
+typedef SpectralCoclusteringT<double> SpectralCoclustering;
+typedef SpectralCoclusteringT<float> SpectralCoclusteringf;
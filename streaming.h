@@ -0,0 +1,307 @@
+/* streaming.h
+Out-of-core input for matrices larger than memory.
+
+The normalized matrix An = D_r^{-1/2} A D_c^{-1/2} is never built. A row
+source replays the nonzeros of A, one range of rows at a time, and
+StreamingOperator forms An X and An^T X from those passes on the fly,
+which is all RandomizedSvd (truncated_svd.h) needs. The rest of the fit
+keeps only (rows + cols) x (k + oversampling) sketches and the embedding.
+
+Row sources:
+* DelimitedRows : a CSV/TSV file, memory mapped and re-parsed on every
+    pass (the kernel pages it in and drops it again as needed). Opening
+    it is pass one: it indexes the lines and computes row and column sums.
+    Rows summing to zero are dropped, as ReadDelimited does.
+* MatrixRows    : an AdjacencyMatrix, in memory or mapped from the binary
+    cache, read in place without a scaled copy.
+
+A fit reads the source 2 * (SVD iterations) + 3 times after pass one, so
+fewer --svd-iters pay off directly here.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Eigen/Dense"
+#include "adjacency_matrix.h"
+#include "delimited_reader.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+/*
+Rows of a delimited file, replayed from its memory mapping.
+*/
+class DelimitedRows
+{
+public:
+    /*
+    Map `path`, index its data lines and compute the sums (pass one).
+    Returns false and fills `error` on failure.
+    */
+    bool Open(const std::string &path, const ReadOptions &options, std::string &error)
+    {
+        if (!file.Open(path))
+        {
+            error = "cannot map " + path;
+            return false;
+        }
+        file.Advise(MADV_SEQUENTIAL);
+        end = file.End();
+        nThreads = options.nThreads;
+
+        if (!IndexGrid(file.Begin(), end, options, path, lines, delimiter, nCols, columnLabels, error))
+        {
+            return false;
+        }
+
+        // Pass one: row sums, and column sums per range reduced in order.
+        Eigen::Index m = (Eigen::Index) lines.size();
+        Eigen::VectorXd lineSums(m);
+        std::vector<Eigen::VectorXd> partialColSums(nThreads, Eigen::VectorXd::Zero(nCols));
+        std::vector<Eigen::Index> badLine(nThreads, -1);
+        #pragma omp parallel for schedule(static) num_threads(nThreads)
+        for (int t = 0; t < nThreads; t++)
+        {
+            int begin, end;
+            LineRange(t, begin, end);
+            Eigen::VectorXd &colSums = partialColSums[t];
+            for (int i = begin; i < end; i++)
+            {
+                double sum = 0.0;
+                if (!ParseRow(i, [&](Eigen::Index j, double v) { sum += v; colSums(j) += v; }) && badLine[t] < 0)
+                {
+                    badLine[t] = i;
+                }
+                lineSums(i) = sum;
+            }
+        }
+        for (int t = 0; t < nThreads; t++)
+        {
+            if (badLine[t] >= 0)
+            {
+                error = "malformed data row " + std::to_string(badLine[t] + 1) + " in " + path;
+                return false;
+            }
+        }
+
+        // Zero-sum rows are dropped; their columns' sums are unaffected.
+        lineRow.assign(m, -1);
+        nRows = 0;
+        for (Eigen::Index i = 0; i < m; i++)
+        {
+            if (lineSums(i) > 0.0)
+            {
+                lineRow[i] = (int) nRows++;
+            }
+        }
+        rowSums.resize(nRows);
+        for (Eigen::Index i = 0; i < m; i++)
+        {
+            if (lineRow[i] >= 0)
+            {
+                rowSums(lineRow[i]) = lineSums(i);
+            }
+        }
+        colSums = Eigen::VectorXd::Zero(nCols);
+        for (int t = 0; t < nThreads; t++)
+        {
+            colSums += partialColSums[t];
+        }
+        return true;
+    }
+
+    Eigen::Index rows() const { return nRows; }
+    Eigen::Index cols() const { return nCols; }
+    int ranges() const { return nThreads; }
+
+    const Eigen::VectorXd &row_sums() const { return rowSums; }
+    const Eigen::VectorXd &col_sums() const { return colSums; }
+    const std::vector<std::string> &column_labels() const { return columnLabels; }
+
+    // Heap bytes held between passes: the line index, sums and labels.
+    size_t memory_bytes() const
+    {
+        return lines.size() * (sizeof(const char *) + sizeof(int)) + (size_t) (nRows + nCols) * sizeof(double)
+            + columnLabels.size() * sizeof(std::string);
+    }
+
+    /*
+    Hand every nonzero of the kept rows in range t of ranges() to
+    visit(row, column, value).
+    */
+    template <typename Visit>
+    void VisitRange(int t, Visit visit) const
+    {
+        int begin, end;
+        LineRange(t, begin, end);
+        for (int i = begin; i < end; i++)
+        {
+            int row = lineRow[i];
+            if (row >= 0)
+            {
+                ParseRow(i, [&](Eigen::Index j, double v) {
+                    if (v != 0.0)
+                    {
+                        visit(row, j, v);
+                    }
+                });
+            }
+        }
+    }
+
+private:
+    void LineRange(int t, int &begin, int &end) const
+    {
+        begin = (int) ((Eigen::Index) lines.size() * t / nThreads);
+        end = (int) ((Eigen::Index) lines.size() * (t + 1) / nThreads);
+    }
+
+    template <typename Store>
+    bool ParseRow(Eigen::Index i, Store store) const
+    {
+        const char *next;
+        const char *lineEnd = LineEnd(lines[i], end, &next);
+        const char *labelEnd;
+        return ParseLine(lines[i], lineEnd, delimiter, nCols, &labelEnd, store);
+    }
+
+    MappedFile file;
+    const char *end = nullptr;
+    char delimiter = 0;
+    int nThreads = 1;
+    std::vector<const char *> lines;
+    std::vector<int> lineRow;  // kept row of each line, -1 when dropped
+    Eigen::Index nRows = 0;
+    Eigen::Index nCols = 0;
+    Eigen::VectorXd rowSums;
+    Eigen::VectorXd colSums;
+    std::vector<std::string> columnLabels;
+};
+
+/*
+Rows of an AdjacencyMatrix (owned or mapped from the cache), read in place.
+*/
+class MatrixRows
+{
+public:
+    MatrixRows(AdjacencyMatrix &matrix, int nThreads) : matrix(matrix), nThreads(nThreads)
+    {
+        ComputeSums(matrix);
+    }
+
+    Eigen::Index rows() const { return matrix.rows(); }
+    Eigen::Index cols() const { return matrix.cols(); }
+    int ranges() const { return nThreads; }
+
+    const Eigen::VectorXd &row_sums() const { return matrix.rowSums; }
+    const Eigen::VectorXd &col_sums() const { return matrix.colSums; }
+    const std::vector<std::string> &column_labels() const { return matrix.columnLabels; }
+
+    // Heap bytes of the matrix (none when mapped) and its sums.
+    size_t memory_bytes() const
+    {
+        return StorageBytes(matrix) + (size_t) (rows() + cols()) * sizeof(double);
+    }
+
+    template <typename Visit>
+    void VisitRange(int t, Visit visit) const
+    {
+        Eigen::Index begin = rows() * t / nThreads;
+        Eigen::Index end = rows() * (t + 1) / nThreads;
+        if (matrix.isSparse)
+        {
+            CsrView sparse = matrix.Sparse();
+            const int *outer = sparse.outerIndexPtr();
+            const int *inner = sparse.innerIndexPtr();
+            const double *values = sparse.valuePtr();
+            for (Eigen::Index i = begin; i < end; i++)
+            {
+                for (int p = outer[i]; p < outer[i + 1]; p++)
+                {
+                    visit((int) i, (Eigen::Index) inner[p], values[p]);
+                }
+            }
+        }
+        else
+        {
+            DenseView dense = matrix.Dense();
+            for (Eigen::Index i = begin; i < end; i++)
+            {
+                for (Eigen::Index j = 0; j < dense.cols(); j++)
+                {
+                    if (dense(i, j) != 0.0)
+                    {
+                        visit((int) i, j, dense(i, j));
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    AdjacencyMatrix &matrix;
+    int nThreads;
+};
+
+/*
+An = diag(rowScale) A diag(colScale) as a matrix-free operator over a row
+source, for RandomizedSvd. Each product is one pass over the source; the
+transposed product scatters into one n x l partial per range, reduced in
+range order so results do not depend on scheduling.
+*/
+template <typename Source, typename ScalarType>
+class StreamingOperator
+{
+public:
+    typedef ScalarType Scalar;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Dense;
+
+    StreamingOperator(const Source &source, const Eigen::VectorXd &rowScale, const Eigen::VectorXd &colScale)
+        : source(source), rowScale(rowScale), colScale(colScale) {}
+
+    Eigen::Index rows() const { return source.rows(); }
+    Eigen::Index cols() const { return source.cols(); }
+
+    // Y = An * X
+    void Apply(const Dense &X, Dense &Y) const
+    {
+        Y.setZero(rows(), X.cols());
+        int nRanges = source.ranges();
+        #pragma omp parallel for schedule(static) num_threads(nRanges)
+        for (int t = 0; t < nRanges; t++)
+        {
+            source.VisitRange(t, [&](int i, Eigen::Index j, double v) {
+                Y.row(i) += (Scalar) (v * rowScale(i) * colScale(j)) * X.row(j);
+            });
+        }
+    }
+
+    // Y = An^T * X
+    void ApplyTranspose(const Dense &X, Dense &Y) const
+    {
+        int nRanges = source.ranges();
+        partial.resize(nRanges);
+        #pragma omp parallel for schedule(static) num_threads(nRanges)
+        for (int t = 0; t < nRanges; t++)
+        {
+            Dense &part = partial[t];
+            part.setZero(cols(), X.cols());
+            source.VisitRange(t, [&](int i, Eigen::Index j, double v) {
+                part.row(j) += (Scalar) (v * rowScale(i) * colScale(j)) * X.row(i);
+            });
+        }
+        Y = partial[0];
+        for (int t = 1; t < nRanges; t++)
+        {
+            Y += partial[t];
+        }
+    }
+
+private:
+    const Source &source;
+    const Eigen::VectorXd &rowScale;
+    const Eigen::VectorXd &colScale;
+    mutable std::vector<Dense> partial;
+};
@@ -0,0 +1,789 @@
+/* triplet_reader.h
+Sparse inputs given entry by entry instead of as a grid:
+
+* Matrix Market (.mtx): the "%%MatrixMarket matrix coordinate" banner,
+    '%' comments, a "rows cols entries" line, then one 1-based
+    "row col [value]" per line. real, integer and pattern (weight 1)
+    fields; general files, or symmetric ones whose off-diagonal entries
+    are mirrored
+* COO triplets (.coo): "row col [weight]" with 0-based integer ids, the
+    weight defaulting to 1. The matrix is (largest row + 1) x (largest
+    col + 1); ids are the labels
+* edge lists (.edges): "row_key col_key [weight]" with arbitrary string
+    keys, for bipartite graphs. Row and column keys are numbered
+    separately, in order of first appearance, and become the labels
+
+Fields are separated by the --delimiter when one is given, else by runs of
+spaces, tabs, commas or semicolons. Blank lines and lines starting with
+'%' or '#' are skipped. A COO or edge-list file may start with a header
+line (ReadOptions::header). Detection recognizes it by a non-numeric id
+(COO) or weight (edge list); a two-column edge list has no weight to tell
+by, so its header is only skipped when the option says "yes".
+
+The file is memory mapped and split into byte ranges at line boundaries,
+which are parsed on separate threads into per-range triplets. AssembleCsr
+builds the CSR from them in parallel without sorting the whole list: a
+counting pass, a prefix sum, a scatter, then a sort of each row by column
+that sums duplicate entries in input order, so the result does not depend
+on the thread count. Rows that sum to zero are dropped, as ReadDelimited
+drops them, and the storage then follows --sparse-threshold.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "adjacency_matrix.h"
+#include "delimited_reader.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+/*
+Entries parsed from one byte range of the input, in file order.
+*/
+struct TripletChunk
+{
+    std::vector<int> rows;
+    std::vector<int> cols;
+    std::vector<double> values;
+    size_t lines = 0;    // lines in the range, for error messages
+    size_t entries = 0;  // data lines parsed
+    long badLine = -1;   // first malformed line, counted within the range
+};
+
+inline bool IsFieldSeparator(char c, char delimiter)
+{
+    return delimiter ? c == delimiter : c == ' ' || c == '\t' || c == ',' || c == ';';
+}
+
+/*
+Next field of [p, lineEnd) as [b, e), trimmed of spaces and tabs; `p`
+moves past it. Returns false when the line has no more fields.
+*/
+inline bool NextField(const char *&p, const char *lineEnd, char delimiter, const char *&b, const char *&e)
+{
+    while (p < lineEnd && (IsFieldSeparator(*p, delimiter) || *p == ' ' || *p == '\t')) ++p;
+    if (p == lineEnd)
+    {
+        return false;
+    }
+    b = p;
+    while (p < lineEnd && !IsFieldSeparator(*p, delimiter)) ++p;
+    e = p;
+    while (e > b && (e[-1] == ' ' || e[-1] == '\t')) --e;
+    return true;
+}
+
+template <typename T>
+bool ParseNumber(const char *b, const char *e, T &value)
+{
+    if (b < e && *b == '+') ++b;
+    std::from_chars_result parsed = std::from_chars(b, e, value);
+    return b < e && parsed.ec == std::errc() && parsed.ptr == e;
+}
+
+inline bool IsCommentLine(const char *p, const char *lineEnd)
+{
+    while (p < lineEnd && (*p == ' ' || *p == '\t')) ++p;
+    return p == lineEnd || *p == '%' || *p == '#';
+}
+
+/*
+Number of byte ranges [begin, end) is parsed in: 8 per thread, of at least
+4 KB.
+*/
+inline int RangeCount(const char *begin, const char *end, int nThreads)
+{
+    return (int) std::max<size_t>(1, std::min<size_t>((size_t) nThreads * 8, (size_t) (end - begin) / 4096 + 1));
+}
+
+/*
+Split [begin, end) into RangeCount byte ranges starting at line starts and
+call parse(range, chunk, line, lineEnd) for every non-comment line, ranges
+on separate threads. `parse` returns false on a malformed line; the first
+one is reported in `error` with its line number, counted from `firstLine`.
+*/
+template <typename ParseLine>
+bool ParseRanges(const char *begin, const char *end, size_t firstLine, int nThreads, std::vector<TripletChunk> &chunks,
+                 const std::string &path, std::string &error, ParseLine parse)
+{
+    size_t size = end - begin;
+    int nChunks = RangeCount(begin, end, nThreads);
+    std::vector<const char *> chunkBegin(nChunks + 1, end);
+    chunkBegin[0] = begin;
+    for (int c = 1; c < nChunks; c++)
+    {
+        // A range starts after the first newline at or after its byte offset - 1.
+        const char *p = std::max(begin + size * c / nChunks - 1, chunkBegin[c - 1]);
+        const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+        chunkBegin[c] = newline ? newline + 1 : end;
+    }
+    chunks.assign(nChunks, TripletChunk());
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+    for (int c = 0; c < nChunks; c++)
+    {
+        TripletChunk &chunk = chunks[c];
+        const char *next;
+        for (const char *p = chunkBegin[c]; p < chunkBegin[c + 1]; p = next)
+        {
+            const char *lineEnd = LineEnd(p, end, &next);
+            if (!IsCommentLine(p, lineEnd))
+            {
+                if (parse(c, chunk, p, lineEnd))
+                {
+                    chunk.entries++;
+                }
+                else if (chunk.badLine < 0)
+                {
+                    chunk.badLine = (long) chunk.lines;
+                }
+            }
+            chunk.lines++;
+        }
+    }
+
+    size_t line = firstLine;
+    for (const TripletChunk &chunk : chunks)
+    {
+        if (chunk.badLine >= 0)
+        {
+            error = "malformed entry on line " + std::to_string(line + chunk.badLine + 1) + " of " + path;
+            return false;
+        }
+        line += chunk.lines;
+    }
+    return true;
+}
+
+/*
+Build `sparse` from the chunks' m x n triplets, which are released on the
+way. Entries of a row keep their chunk and file order through the counting
+pass (entries per row, per group of chunks), the prefix sum over rows and
+groups and the scatter, so duplicates are summed in input order; entries
+that sum to zero are dropped, and so are rows that do, leaving `keptRows`
+(ascending) as the rows of `sparse`.
+*/
+inline void AssembleCsr(Eigen::Index m, Eigen::Index n, std::vector<TripletChunk> &chunks, int nThreads,
+                        CsrMatrix &sparse, std::vector<int> &keptRows)
+{
+    int nChunks = (int) chunks.size();
+    int nGroups = std::max(1, std::min(nThreads, nChunks));
+
+    // Counting pass: offsets[g][i] counts row i's entries in group g.
+    std::vector<std::vector<size_t>> offsets(nGroups);
+    #pragma omp parallel for schedule(static) num_threads(nGroups)
+    for (int g = 0; g < nGroups; g++)
+    {
+        offsets[g].assign(m, 0);
+        for (int c = nChunks * g / nGroups; c < nChunks * (g + 1) / nGroups; c++)
+        {
+            for (int row : chunks[c].rows)
+            {
+                offsets[g][row]++;
+            }
+        }
+    }
+
+    // Prefix sum over rows, then over groups within each row.
+    std::vector<size_t> rowStart(m + 1, 0);
+    for (Eigen::Index i = 0; i < m; i++)
+    {
+        size_t count = 0;
+        for (int g = 0; g < nGroups; g++)
+        {
+            count += offsets[g][i];
+        }
+        rowStart[i + 1] = rowStart[i] + count;
+    }
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (Eigen::Index i = 0; i < m; i++)
+    {
+        size_t position = rowStart[i];
+        for (int g = 0; g < nGroups; g++)
+        {
+            size_t count = offsets[g][i];
+            offsets[g][i] = position;
+            position += count;
+        }
+    }
+
+    // Scatter every group's entries into its slots of their rows.
+    size_t entries = rowStart[m];
+    std::vector<int> inner(entries);
+    std::vector<double> values(entries);
+    #pragma omp parallel for schedule(static) num_threads(nGroups)
+    for (int g = 0; g < nGroups; g++)
+    {
+        std::vector<size_t> &position = offsets[g];
+        for (int c = nChunks * g / nGroups; c < nChunks * (g + 1) / nGroups; c++)
+        {
+            TripletChunk &chunk = chunks[c];
+            for (size_t e = 0; e < chunk.rows.size(); e++)
+            {
+                size_t p = position[chunk.rows[e]]++;
+                inner[p] = chunk.cols[e];
+                values[p] = chunk.values[e];
+            }
+            chunk = TripletChunk();
+        }
+        std::vector<size_t>().swap(position);
+    }
+
+    // Sort each row by column, summing duplicates, and compact it in place.
+    std::vector<int> length(m);
+    std::vector<double> rowSum(m);
+    #pragma omp parallel num_threads(nThreads)
+    {
+        std::vector<std::pair<int, double>> row;
+        #pragma omp for schedule(dynamic, 256)
+        for (Eigen::Index i = 0; i < m; i++)
+        {
+            row.clear();
+            for (size_t p = rowStart[i]; p < rowStart[i + 1]; p++)
+            {
+                row.emplace_back(inner[p], values[p]);
+            }
+            std::stable_sort(row.begin(), row.end(),
+                             [](const std::pair<int, double> &a, const std::pair<int, double> &b) { return a.first < b.first; });
+            size_t kept = 0;
+            double sum = 0.0;
+            for (size_t e = 0; e < row.size();)
+            {
+                int col = row[e].first;
+                double value = 0.0;
+                for (; e < row.size() && row[e].first == col; e++)
+                {
+                    value += row[e].second;
+                }
+                if (value != 0.0)
+                {
+                    inner[rowStart[i] + kept] = col;
+                    values[rowStart[i] + kept] = value;
+                    kept++;
+                    sum += value;
+                }
+            }
+            length[i] = (int) kept;
+            rowSum[i] = sum;
+        }
+    }
+
+    // Prefix sum of the kept rows' lengths, then copy them into place.
+    keptRows.clear();
+    std::vector<int> outer(1, 0);
+    for (Eigen::Index i = 0; i < m; i++)
+    {
+        if (rowSum[i] > 0.0)
+        {
+            keptRows.push_back((int) i);
+            outer.push_back(outer.back() + length[i]);
+        }
+    }
+    Eigen::Index kept = (Eigen::Index) keptRows.size();
+    sparse.resize(kept, n);
+    sparse.resizeNonZeros(outer[kept]);
+    std::copy(outer.begin(), outer.end(), sparse.outerIndexPtr());
+    #pragma omp parallel for schedule(static) num_threads(nThreads)
+    for (Eigen::Index r = 0; r < kept; r++)
+    {
+        size_t source = rowStart[keptRows[r]];
+        std::copy_n(inner.begin() + source, outer[r + 1] - outer[r], sparse.innerIndexPtr() + outer[r]);
+        std::copy_n(values.begin() + source, outer[r + 1] - outer[r], sparse.valuePtr() + outer[r]);
+    }
+}
+
+/*
+Assemble `matrix` from the chunks, whose rows are labelled
+matrix.rowLabels, and pick its storage.
+*/
+inline void FinishAssembly(Eigen::Index m, Eigen::Index n, std::vector<TripletChunk> &chunks,
+                           const ReadOptions &options, AdjacencyMatrix &matrix)
+{
+    std::vector<int> keptRows;
+    AssembleCsr(m, n, chunks, options.nThreads, matrix.sparse, keptRows);
+    for (size_t r = 0; r < keptRows.size(); r++)
+    {
+        if (keptRows[r] != (int) r)
+        {
+            matrix.rowLabels[r].swap(matrix.rowLabels[keptRows[r]]);
+        }
+    }
+    matrix.rowLabels.resize(keptRows.size());
+    matrix.isSparse = true;
+    ApplySparseThreshold(matrix, matrix.sparse.nonZeros(), options.sparseThreshold);
+}
+
+/*
+Estimated peak bytes of reading `entries` triplets: the parsed triplets
+and the scatter arrays are both alive during the scatter, then the
+scatter arrays and the final CSR.
+*/
+inline size_t TripletBytes(size_t entries)
+{
+    return entries * (2 * sizeof(int) + sizeof(double)) + 2 * entries * (sizeof(int) + sizeof(double));
+}
+
+/*
+Entries of the input [begin, end), estimated from the length of its first
+lines.
+*/
+inline size_t EstimateEntries(const char *begin, const char *end)
+{
+    const char *next;
+    const char *p = begin;
+    size_t lines = 0;
+    for (; p < end && lines < 1000; p = next, lines++)
+    {
+        LineEnd(p, end, &next);
+    }
+    return p == end ? lines : (size_t) ((double) lines * (double) (end - begin) / (double) (p - begin));
+}
+
+inline bool WithinReadBudget(size_t entries, const std::string &path, const ReadOptions &options, std::string &error)
+{
+    size_t needed = TripletBytes(entries);
+    if (options.maxMemory > 0 && needed > options.maxMemory)
+    {
+        error = "parsing " + path + " needs about " + std::to_string((needed + (1 << 20) - 1) >> 20) + " MB, over the "
+            + std::to_string(options.maxMemory >> 20) + " MB memory budget";
+        return false;
+    }
+    return true;
+}
+
+/*
+Read a Matrix Market coordinate file into `matrix`. Returns false and
+fills `error` on failure.
+*/
+inline bool ReadMatrixMarket(const std::string &path, const ReadOptions &options, AdjacencyMatrix &matrix,
+                             std::string &error)
+{
+    MappedFile file;
+    if (!file.Open(path))
+    {
+        error = "cannot map " + path;
+        return false;
+    }
+    file.Advise(MADV_SEQUENTIAL);
+    const char *end = file.End();
+
+    // Banner: %%MatrixMarket matrix coordinate <field> <symmetry>
+    const char *next;
+    const char *banner = file.Begin();
+    const char *bannerEnd = LineEnd(banner, end, &next);
+    std::vector<std::string> words;
+    {
+        const char *p = banner;
+        const char *b, *e;
+        while (NextField(p, bannerEnd, ' ', b, e))
+        {
+            std::string word(b, e);
+            std::transform(word.begin(), word.end(), word.begin(), [](unsigned char c) { return (char) tolower(c); });
+            words.push_back(word);
+        }
+    }
+    if (words.size() != 5 || words[0] != "%%matrixmarket" || words[1] != "matrix")
+    {
+        error = path + " has no Matrix Market banner";
+        return false;
+    }
+    const std::string &field = words[3];
+    const std::string &symmetry = words[4];
+    if (words[2] != "coordinate" || (field != "real" && field != "integer" && field != "pattern")
+        || (symmetry != "general" && symmetry != "symmetric"))
+    {
+        error = path + ": only real, integer or pattern coordinate matrices, general or symmetric, are supported";
+        return false;
+    }
+    bool pattern = field == "pattern";
+    bool symmetric = symmetry == "symmetric";
+
+    // Size line after the comments.
+    size_t lineNumber = 1;
+    const char *p = next;
+    const char *sizeEnd = p;
+    for (; p < end; p = next)
+    {
+        sizeEnd = LineEnd(p, end, &next);
+        lineNumber++;
+        if (!IsCommentLine(p, sizeEnd))
+        {
+            break;
+        }
+    }
+    long long m = 0, n = 0, declared = 0;
+    {
+        const char *q = p;
+        const char *b[3], *e[3];
+        bool ok = p < end;
+        for (int f = 0; f < 3 && ok; f++)
+        {
+            ok = NextField(q, sizeEnd, ' ', b[f], e[f]);
+        }
+        if (!ok || !ParseNumber(b[0], e[0], m) || !ParseNumber(b[1], e[1], n) || !ParseNumber(b[2], e[2], declared)
+            || m < 1 || n < 1 || declared < 0 || m > std::numeric_limits<int>::max() || n > std::numeric_limits<int>::max() || (symmetric && m != n))
+        {
+            error = "bad size line in " + path;
+            return false;
+        }
+    }
+
+    size_t entries = (size_t) declared * (symmetric ? 2 : 1);
+    if (!WithinReadBudget(entries, path, options, error))
+    {
+        return false;
+    }
+
+    std::vector<TripletChunk> chunks;
+    bool ok = ParseRanges(next, end, lineNumber, options.nThreads, chunks, path, error,
+                          [&](int, TripletChunk &chunk, const char *p, const char *lineEnd) {
+        const char *b, *e;
+        long long i, j;
+        double value = 1.0;
+        if (!NextField(p, lineEnd, 0, b, e) || !ParseNumber(b, e, i)
+            || !NextField(p, lineEnd, 0, b, e) || !ParseNumber(b, e, j)
+            || i < 1 || i > m || j < 1 || j > n)
+        {
+            return false;
+        }
+        if (!pattern && (!NextField(p, lineEnd, 0, b, e) || !ParseNumber(b, e, value)))
+        {
+            return false;
+        }
+        chunk.rows.push_back((int) (i - 1));
+        chunk.cols.push_back((int) (j - 1));
+        chunk.values.push_back(value);
+        if (symmetric && i != j)
+        {
+            chunk.rows.push_back((int) (j - 1));
+            chunk.cols.push_back((int) (i - 1));
+            chunk.values.push_back(value);
+        }
+        return true;
+    });
+    if (!ok)
+    {
+        return false;
+    }
+    size_t parsed = 0;
+    for (const TripletChunk &chunk : chunks)
+    {
+        parsed += chunk.entries;
+    }
+    if (parsed != (size_t) declared)
+    {
+        error = path + " declares " + std::to_string(declared) + " entries but has " + std::to_string(parsed);
+        return false;
+    }
+
+    matrix.rowLabels.resize(m);
+    for (long long i = 0; i < m; i++)
+    {
+        matrix.rowLabels[i] = std::to_string(i + 1);
+    }
+    matrix.columnLabels.resize(n);
+    for (long long j = 0; j < n; j++)
+    {
+        matrix.columnLabels[j] = std::to_string(j + 1);
+    }
+    FinishAssembly(m, n, chunks, options, matrix);
+    return true;
+}
+
+/*
+First line of [begin, end) that is not blank or a comment; `next` is set
+past it.
+*/
+inline const char *FirstDataLine(const char *begin, const char *end, const char **lineEnd, const char **next,
+                                 size_t &lineNumber)
+{
+    const char *p = begin;
+    for (; p < end; p = *next)
+    {
+        *lineEnd = LineEnd(p, end, next);
+        if (!IsCommentLine(p, *lineEnd))
+        {
+            return p;
+        }
+        lineNumber++;
+    }
+    *lineEnd = *next = end;
+    return end;
+}
+
+/*
+Read COO triplets with 0-based integer ids into `matrix`. Returns false
+and fills `error` on failure.
+*/
+inline bool ReadTriplets(const std::string &path, const ReadOptions &options, AdjacencyMatrix &matrix,
+                         std::string &error)
+{
+    MappedFile file;
+    if (!file.Open(path))
+    {
+        error = "cannot map " + path;
+        return false;
+    }
+    file.Advise(MADV_SEQUENTIAL);
+    const char *begin = file.Begin();
+    const char *end = file.End();
+
+    // Skip a header line, detected by a first field that is not an id.
+    size_t lineNumber = 0;
+    const char *first, *firstEnd, *next;
+    first = FirstDataLine(begin, end, &firstEnd, &next, lineNumber);
+    const char *b, *e;
+    long long id;
+    const char *q = first;
+    if (first < end && IsHeader(options, !(NextField(q, firstEnd, options.delimiter, b, e) && ParseNumber(b, e, id))))
+    {
+        begin = next;
+        lineNumber++;
+    }
+
+    if (!WithinReadBudget(EstimateEntries(begin, end), path, options, error))
+    {
+        return false;
+    }
+
+    std::vector<TripletChunk> chunks;
+    bool ok = ParseRanges(begin, end, lineNumber, options.nThreads, chunks, path, error,
+                          [&](int, TripletChunk &chunk, const char *p, const char *lineEnd) {
+        const char *b, *e;
+        long long i, j;
+        double value = 1.0;
+        if (!NextField(p, lineEnd, options.delimiter, b, e) || !ParseNumber(b, e, i)
+            || !NextField(p, lineEnd, options.delimiter, b, e) || !ParseNumber(b, e, j)
+            || i < 0 || i >= std::numeric_limits<int>::max() || j < 0 || j >= std::numeric_limits<int>::max()
+            || (NextField(p, lineEnd, options.delimiter, b, e) && !ParseNumber(b, e, value)))
+        {
+            return false;
+        }
+        chunk.rows.push_back((int) i);
+        chunk.cols.push_back((int) j);
+        chunk.values.push_back(value);
+        return true;
+    });
+    if (!ok)
+    {
+        return false;
+    }
+
+    int m = 0, n = 0;
+    for (const TripletChunk &chunk : chunks)
+    {
+        for (size_t e = 0; e < chunk.rows.size(); e++)
+        {
+            m = std::max(m, chunk.rows[e] + 1);
+            n = std::max(n, chunk.cols[e] + 1);
+        }
+    }
+    if (m == 0)
+    {
+        error = path + " has no entries";
+        return false;
+    }
+
+    matrix.rowLabels.resize(m);
+    for (int i = 0; i < m; i++)
+    {
+        matrix.rowLabels[i] = std::to_string(i);
+    }
+    matrix.columnLabels.resize(n);
+    for (int j = 0; j < n; j++)
+    {
+        matrix.columnLabels[j] = std::to_string(j);
+    }
+    FinishAssembly(m, n, chunks, options, matrix);
+    return true;
+}
+
+/*
+Read a string-keyed edge list into `matrix`. Every range numbers the keys
+it meets in a local dictionary; the dictionaries are then merged in range
+order, which numbers the keys in order of first appearance in the file,
+and the ranges' local ids are rewritten in parallel. Returns false and
+fills `error` on failure.
+*/
+inline bool ReadEdgeList(const std::string &path, const ReadOptions &options, AdjacencyMatrix &matrix,
+                         std::string &error)
+{
+    MappedFile file;
+    if (!file.Open(path))
+    {
+        error = "cannot map " + path;
+        return false;
+    }
+    file.Advise(MADV_SEQUENTIAL);
+    const char *begin = file.Begin();
+    const char *end = file.End();
+
+    // Skip a header line, detected by a weight that is not a number.
+    size_t lineNumber = 0;
+    const char *first, *firstEnd, *next;
+    first = FirstDataLine(begin, end, &firstEnd, &next, lineNumber);
+    const char *b, *e;
+    double weight;
+    const char *q = first;
+    if (first < end
+        && IsHeader(options, NextField(q, firstEnd, options.delimiter, b, e)
+                                 && NextField(q, firstEnd, options.delimiter, b, e)
+                                 && NextField(q, firstEnd, options.delimiter, b, e) && !ParseNumber(b, e, weight)))
+    {
+        begin = next;
+        lineNumber++;
+    }
+
+    if (!WithinReadBudget(EstimateEntries(begin, end), path, options, error))
+    {
+        return false;
+    }
+
+    // Keys of each range in order of first appearance; the triplets hold indices into them.
+    typedef std::unordered_map<std::string_view, int> KeyIds;
+    struct RangeKeys
+    {
+        KeyIds rowIds, colIds;
+        std::vector<std::string_view> rows, cols;
+        std::string_view lastRow;  // edge lists are usually grouped by row: skip its lookup
+        int lastRowId = -1;
+    };
+    std::vector<RangeKeys> keys;
+    std::vector<TripletChunk> chunks;
+    int nThreads = options.nThreads;
+    keys.resize(RangeCount(begin, end, nThreads));
+    auto localId = [](KeyIds &ids, std::vector<std::string_view> &list, const char *b, const char *e) {
+        std::pair<KeyIds::iterator, bool> inserted = ids.try_emplace(std::string_view(b, e - b), (int) list.size());
+        if (inserted.second)
+        {
+            list.push_back(inserted.first->first);
+        }
+        return inserted.first->second;
+    };
+    bool ok = ParseRanges(begin, end, lineNumber, nThreads, chunks, path, error,
+                          [&](int c, TripletChunk &chunk, const char *p, const char *lineEnd) {
+        RangeKeys &range = keys[c];
+        const char *rowBegin, *rowEnd, *colBegin, *colEnd, *b, *e;
+        double value = 1.0;
+        if (!NextField(p, lineEnd, options.delimiter, rowBegin, rowEnd)
+            || !NextField(p, lineEnd, options.delimiter, colBegin, colEnd)
+            || (NextField(p, lineEnd, options.delimiter, b, e) && !ParseNumber(b, e, value)))
+        {
+            return false;
+        }
+        if (range.lastRowId < 0 || range.lastRow != std::string_view(rowBegin, rowEnd - rowBegin))
+        {
+            range.lastRowId = localId(range.rowIds, range.rows, rowBegin, rowEnd);
+            range.lastRow = range.rows[range.lastRowId];
+        }
+        chunk.rows.push_back(range.lastRowId);
+        chunk.cols.push_back(localId(range.colIds, range.cols, colBegin, colEnd));
+        chunk.values.push_back(value);
+        return true;
+    });
+    if (!ok)
+    {
+        return false;
+    }
+
+    // Merge the dictionaries in range order into global ids.
+    int nChunks = (int) chunks.size();
+    KeyIds rowIds, colIds;
+    std::vector<std::vector<int>> rowMap(nChunks), colMap(nChunks);
+    matrix.rowLabels.clear();
+    matrix.columnLabels.clear();
+    for (int c = 0; c < nChunks; c++)
+    {
+        for (std::string_view key : keys[c].rows)
+        {
+            std::pair<KeyIds::iterator, bool> inserted = rowIds.try_emplace(key, (int) matrix.rowLabels.size());
+            if (inserted.second)
+            {
+                matrix.rowLabels.emplace_back(key);
+            }
+            rowMap[c].push_back(inserted.first->second);
+        }
+        for (std::string_view key : keys[c].cols)
+        {
+            std::pair<KeyIds::iterator, bool> inserted = colIds.try_emplace(key, (int) matrix.columnLabels.size());
+            if (inserted.second)
+            {
+                matrix.columnLabels.emplace_back(key);
+            }
+            colMap[c].push_back(inserted.first->second);
+        }
+        keys[c] = RangeKeys();
+    }
+    if (matrix.rowLabels.empty())
+    {
+        error = path + " has no entries";
+        return false;
+    }
+
+    #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+    for (int c = 0; c < nChunks; c++)
+    {
+        for (int &row : chunks[c].rows)
+        {
+            row = rowMap[c][row];
+        }
+        for (int &col : chunks[c].cols)
+        {
+            col = colMap[c][col];
+        }
+    }
+
+    FinishAssembly((Eigen::Index) matrix.rowLabels.size(), (Eigen::Index) matrix.columnLabels.size(), chunks, options,
+                   matrix);
+    return true;
+}
+
+/*
+Input format of `path`: `format` unless it is "auto", else picked from
+the extension (.mtx, .coo, .edges), defaulting to a delimited grid.
+*/
+inline std::string InputFormat(const std::string &path, const std::string &format)
+{
+    if (format != "auto")
+    {
+        return format;
+    }
+    size_t dot = path.rfind('.');
+    std::string extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char) tolower(c); });
+    if (extension == "mtx" || extension == "coo" || extension == "edges")
+    {
+        return extension;
+    }
+    return "grid";
+}
+
+/*
+Read `path` in its input format (options.format, see InputFormat).
+*/
+inline bool ReadMatrix(const std::string &path, const ReadOptions &options, AdjacencyMatrix &matrix, std::string &error)
+{
+    std::string format = InputFormat(path, options.format);
+    if (format == "mtx")
+    {
+        return ReadMatrixMarket(path, options, matrix, error);
+    }
+    if (format == "coo")
+    {
+        return ReadTriplets(path, options, matrix, error);
+    }
+    if (format == "edges")
+    {
+        return ReadEdgeList(path, options, matrix, error);
+    }
+    return ReadDelimited(path, options, matrix, error);
+}
@@ -0,0 +1,274 @@
+/* truncated_svd.h
+Top-k singular triplets of the normalized adjacency matrix.
+
+Co-clustering only keeps singular vectors 1..k, so computing the full thin
+SVD is wasted work. The randomized engine (Halko, Martinsson & Tropp 2011,
+subspace iteration variant) touches the matrix only through products with
+A and A^T, so anything exposing those products can be decomposed: dense
+and sparse Eigen matrices are wrapped by MatrixOperator below.
+
+Everything is templated on the scalar type, so the same code runs in
+double (TruncatedSvd, SvdWorkspace) or float (TruncatedSvdf,
+SvdWorkspacef) depending on the operator's Scalar.
+
+A previous decomposition can seed the randomized engine: when the
+workspace's `start` block is set, it replaces the leading columns of the
+Gaussian sketch, so a slightly changed matrix starts from the old right
+singular subspace and converges in a couple of power iterations.
+
+The exact Eigen decompositions are kept as a selectable reference:
+* "randomized" : randomized range finder + power iterations (default)
+* "jacobi"     : Eigen::JacobiSVD
+* "bdc"        : Eigen::BDCSVD
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <string>
+
+#include "Eigen/Dense"
+#include "Eigen/SVD"
+
+struct SvdOptions
+{
+    std::string method = "randomized";
+    int oversampling = 10;     // extra columns in the sketch beyond k
+    int maxIterations = 20;    // cap on power iterations
+    double tolerance = 1e-6;   // relative change of the top k singular values
+    unsigned int seed = 42;
+};
+
+template <typename Scalar>
+struct TruncatedSvdT
+{
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 1> singularValues;
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> U;
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> V;
+    int iterations = 0;
+};
+
+typedef TruncatedSvdT<double> TruncatedSvd;
+typedef TruncatedSvdT<float> TruncatedSvdf;
+
+/*
+Matrix-free operator over any Eigen matrix expression type.
+*/
+template <typename MatrixType>
+class MatrixOperator
+{
+public:
+    typedef typename MatrixType::Scalar Scalar;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Dense;
+
+    explicit MatrixOperator(const MatrixType &matrix) : matrix(matrix) {}
+
+    Eigen::Index rows() const { return matrix.rows(); }
+    Eigen::Index cols() const { return matrix.cols(); }
+
+    // Y = A * X
+    void Apply(const Dense &X, Dense &Y) const
+    {
+        Y.noalias() = matrix * X;
+    }
+
+    // Y = A^T * X
+    void ApplyTranspose(const Dense &X, Dense &Y) const
+    {
+        Y.noalias() = matrix.transpose() * X;
+    }
+
+private:
+    const MatrixType &matrix;
+};
+
+/*
+Scratch space of RandomizedSvd. Sized on the first call; later calls with
+the same shape and rank reuse every buffer and allocate nothing.
+*/
+template <typename Scalar>
+struct SvdWorkspaceT
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Dense;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+    Dense omega;  // n x l Gaussian test matrix
+    Dense start;  // optional n x s warm start for the first s sketch columns
+    Dense Q;      // m x l range basis
+    Dense W;      // n x l co-range basis
+    Dense R;      // l x l triangular factor
+    Vector previous;
+    Vector current;
+    Vector reflector;  // Householder application scratch
+    Eigen::HouseholderQR<Dense> rangeQr;
+    Eigen::HouseholderQR<Dense> coRangeQr;
+    Eigen::JacobiSVD<Dense> estimate;
+    Eigen::JacobiSVD<Dense> small;
+};
+
+typedef SvdWorkspaceT<double> SvdWorkspace;
+typedef SvdWorkspaceT<float> SvdWorkspacef;
+
+/*
+Overwrite Q with the thin (rows x cols) Q factor of `qr`, applying the
+reflectors one at a time so no temporary is allocated.
+*/
+template <typename Dense, typename Vector>
+void FormThinQ(const Eigen::HouseholderQR<Dense> &qr, Dense &Q, Vector &scratch)
+{
+    Eigen::Index m = qr.rows();
+    Eigen::Index l = qr.cols();
+    scratch.resize(l);
+    Q.setIdentity(m, l);
+    for (Eigen::Index k = l - 1; k >= 0; k--)
+    {
+        Q.bottomRightCorner(m - k, l - k).applyHouseholderOnTheLeft(
+            qr.matrixQR().col(k).tail(m - k - 1), qr.hCoeffs()(k), scratch.data());
+    }
+}
+
+/*
+Replace the columns of Y (rows >= cols) by an orthonormal basis of their
+span.
+*/
+template <typename Dense, typename Vector>
+void Orthonormalize(Dense &Y, Eigen::HouseholderQR<Dense> &qr, Vector &scratch)
+{
+    qr.compute(Y);
+    FormThinQ(qr, Y, scratch);
+}
+
+/*
+Randomized SVD of the operator A, keeping the top `rank` triplets.
+Iterates Q <- orth(A orth(A^T Q)) until the leading singular values stop
+moving by more than `tolerance` (relative, floored at a few ulps of the
+scalar type) or `maxIterations` is reached.
+*/
+template <typename Operator>
+void RandomizedSvd(const Operator &A, int rank, const SvdOptions &options,
+                   TruncatedSvdT<typename Operator::Scalar> &result, SvdWorkspaceT<typename Operator::Scalar> &work)
+{
+    typedef typename Operator::Scalar Scalar;
+    typedef typename SvdWorkspaceT<Scalar>::Dense Dense;
+
+    Eigen::Index m = A.rows();
+    Eigen::Index n = A.cols();
+    // Never sketch fewer columns than the rank kept, whatever the oversampling.
+    Eigen::Index l = std::min<Eigen::Index>(rank + std::max(options.oversampling, 0), std::min(m, n));
+    double tolerance = std::max(options.tolerance, 10.0 * std::numeric_limits<Scalar>::epsilon());
+
+    // Drawn in double so both precisions start from the same sketch.
+    std::mt19937 generator(options.seed);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    Dense &omega = work.omega;
+    omega.resize(n, l);
+    Eigen::Index seeded = work.start.rows() == n ? std::min(work.start.cols(), l) : 0;
+    if (seeded > 0)
+    {
+        omega.leftCols(seeded) = work.start.leftCols(seeded);
+    }
+    for (Eigen::Index j = seeded; j < l; j++)
+    {
+        for (Eigen::Index i = 0; i < n; i++)
+        {
+            omega(i, j) = (Scalar) normal(generator);
+        }
+    }
+
+    Dense &Q = work.Q;
+    Dense &W = work.W;
+    Q.resize(m, l);
+    W.resize(n, l);
+    A.Apply(omega, Q);
+    Orthonormalize(Q, work.rangeQr, work.reflector);
+
+    work.previous.setZero(rank);
+    result.iterations = 0;
+    for (int iter = 0; iter < options.maxIterations; iter++)
+    {
+        A.ApplyTranspose(Q, W);
+        Orthonormalize(W, work.coRangeQr, work.reflector);
+        A.Apply(W, Q);
+
+        // Q^T A W is the R factor of A W; its singular values estimate A's.
+        work.rangeQr.compute(Q);
+        FormThinQ(work.rangeQr, Q, work.reflector);
+        work.R = work.rangeQr.matrixQR().topRows(l).template triangularView<Eigen::Upper>();
+        work.estimate.compute(work.R);
+        work.current = work.estimate.singularValues().head(rank);
+        result.iterations = iter + 1;
+
+        double change = (work.current - work.previous).cwiseAbs().maxCoeff();
+        work.previous = work.current;
+        if (change <= tolerance * work.current(0))
+        {
+            break;
+        }
+    }
+
+    // B = Q^T A, decomposed through its transpose B^T = A^T Q = Qw Rw,
+    // Rw = Ur S Vr^T, so B^T = (Qw Ur) S Vr^T.
+    A.ApplyTranspose(Q, W);
+    work.coRangeQr.compute(W);
+    FormThinQ(work.coRangeQr, W, work.reflector);
+    work.R = work.coRangeQr.matrixQR().topRows(l).template triangularView<Eigen::Upper>();
+    work.small.compute(work.R, Eigen::ComputeThinU | Eigen::ComputeThinV);
+    result.singularValues = work.small.singularValues().head(rank);
+    result.U.noalias() = Q * work.small.matrixV().leftCols(rank);
+    result.V.noalias() = W * work.small.matrixU().leftCols(rank);
+}
+
+template <typename Operator>
+void RandomizedSvd(const Operator &A, int rank, const SvdOptions &options,
+                   TruncatedSvdT<typename Operator::Scalar> &result)
+{
+    SvdWorkspaceT<typename Operator::Scalar> work;
+    RandomizedSvd(A, rank, options, result, work);
+}
+
+/*
+Exact reference decomposition, truncated to the top `rank` triplets.
+*/
+template <typename SVDType, typename Scalar>
+void ExactSvd(const typename SVDType::MatrixType &A, int rank, TruncatedSvdT<Scalar> &result)
+{
+    SVDType svd(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
+    result.singularValues = svd.singularValues().head(rank);
+    result.U = svd.matrixU().leftCols(rank);
+    result.V = svd.matrixV().leftCols(rank);
+    result.iterations = 0;
+}
+
+/*
+Compute the top `rank` singular triplets of A with the engine named by
+`options.method`. Exact methods work on a dense copy of sparse inputs and
+do not use `work`.
+*/
+template <typename MatrixType>
+void ComputeSvd(const MatrixType &A, int rank, const SvdOptions &options,
+                TruncatedSvdT<typename MatrixType::Scalar> &result, SvdWorkspaceT<typename MatrixType::Scalar> &work)
+{
+    typedef typename SvdWorkspaceT<typename MatrixType::Scalar>::Dense Dense;
+    if (options.method == "randomized")
+    {
+        RandomizedSvd(MatrixOperator<MatrixType>(A), rank, options, result, work);
+    }
+    else if (options.method == "jacobi")
+    {
+        ExactSvd<Eigen::JacobiSVD<Dense>>(A, rank, result);
+    }
+    else if (options.method == "bdc")
+    {
+        ExactSvd<Eigen::BDCSVD<Dense>>(A, rank, result);
+    }
+}
+
+template <typename MatrixType>
+void ComputeSvd(const MatrixType &A, int rank, const SvdOptions &options,
+                TruncatedSvdT<typename MatrixType::Scalar> &result)
+{
+    SvdWorkspaceT<typename MatrixType::Scalar> work;
+    ComputeSvd(A, rank, options, result, work);
+}
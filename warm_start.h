@@ -0,0 +1,233 @@
+/* warm_start.h
+Model state carried from one run to the next, for inputs that change a
+little between runs (rows or columns added, removed or edited). It is
+also the saved model predictor.h assigns new rows and columns with.
+
+A fit can be seeded with the state saved by an earlier one: the previous
+right singular vectors start the randomized SVD's sketch, and the previous
+centroids start k-means. Rows and columns are matched to the saved ones by
+label, so the input may gain, lose or reorder them.
+
+Layout (native endianness):
+  WarmHeader
+  labels         : row labels then column labels, each a uint32 length + bytes
+  singularValues : double[rank]
+  rowScale       : double[rows]   D_r^{-1/2} of the fitted matrix (r if bistochastic)
+  colScale       : double[cols]   D_c^{-1/2} (c if bistochastic)
+  U              : double[rows * rank] column-major
+  V              : double[cols * rank] column-major
+  centroids      : double[clusters * clusters] column-major
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Eigen/Dense"
+
+const char WarmMagic[8] = {'S', 'C', 'W', 'A', 'R', 'M', '\0', '\0'};
+const uint32_t WarmVersion = 3;
+
+struct WarmHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t clusters;
+    int64_t rows;
+    int64_t cols;
+    int64_t rank;
+    uint64_t labelsSize;
+    uint32_t bistochastic;  // 1 when the scales are Sinkhorn ones
+    uint32_t reserved;
+};
+
+struct WarmState
+{
+    std::vector<std::string> rowLabels;
+    std::vector<std::string> columnLabels;
+    Eigen::VectorXd singularValues;  // 0..rank-1, 0 is the trivial one
+    bool bistochastic = false;       // scales from Sinkhorn balancing, see bistochastic.h
+    Eigen::VectorXd rowScale;        // 1 / sqrt(row sums), 0 for empty rows
+    Eigen::VectorXd colScale;        // 1 / sqrt(column sums)
+    Eigen::MatrixXd U;               // rows x rank
+    Eigen::MatrixXd V;               // cols x rank
+    Eigen::ArrayXXd centroids;       // clusters x clusters, in the embedding
+
+    int clusters() const { return (int) centroids.rows(); }
+};
+
+/*
+For each of the `count` current rows (or columns), the index of the
+previous one with the same label, or -1 when it is new. Without labels on
+either side, the first min(count, previousCount) are matched by position.
+Returns the number of matches.
+*/
+inline int MatchLabels(const std::vector<std::string> &previous, Eigen::Index previousCount,
+                       const std::vector<std::string> &current, Eigen::Index count, std::vector<int> &previousIndex)
+{
+    previousIndex.assign(count, -1);
+    int matched = 0;
+    if (previous.empty() || current.empty())
+    {
+        for (Eigen::Index i = 0; i < count && i < previousCount; i++)
+        {
+            previousIndex[i] = (int) i;
+            matched++;
+        }
+        return matched;
+    }
+
+    std::unordered_map<std::string, int> index;
+    index.reserve(previous.size());
+    for (size_t i = 0; i < previous.size(); i++)
+    {
+        index.emplace(previous[i], (int) i);
+    }
+    for (Eigen::Index i = 0; i < count; i++)
+    {
+        auto found = index.find(current[i]);
+        if (found != index.end())
+        {
+            previousIndex[i] = found->second;
+            matched++;
+        }
+    }
+    return matched;
+}
+
+/*
+Write `state` to `path`, through a temporary file renamed into place.
+*/
+inline bool WriteWarmState(const std::string &path, const WarmState &state, std::string &error)
+{
+    std::string labels;
+    for (const std::vector<std::string> *list : {&state.rowLabels, &state.columnLabels})
+    {
+        for (const std::string &label : *list)
+        {
+            uint32_t length = (uint32_t) label.size();
+            labels.append(reinterpret_cast<const char *>(&length), sizeof(length));
+            labels.append(label);
+        }
+    }
+
+    WarmHeader header = WarmHeader();
+    memcpy(header.magic, WarmMagic, sizeof(WarmMagic));
+    header.version = WarmVersion;
+    header.clusters = (uint32_t) state.clusters();
+    header.rows = state.U.rows();
+    header.cols = state.V.rows();
+    header.rank = state.singularValues.size();
+    header.labelsSize = labels.size();
+    header.bistochastic = state.bistochastic ? 1 : 0;
+
+    std::string temporary = path + ".tmp";
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        error = "cannot write " + temporary;
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(labels.data(), labels.size());
+    out.write(reinterpret_cast<const char *>(state.singularValues.data()), sizeof(double) * header.rank);
+    out.write(reinterpret_cast<const char *>(state.rowScale.data()), sizeof(double) * header.rows);
+    out.write(reinterpret_cast<const char *>(state.colScale.data()), sizeof(double) * header.cols);
+    out.write(reinterpret_cast<const char *>(state.U.data()), sizeof(double) * state.U.size());
+    out.write(reinterpret_cast<const char *>(state.V.data()), sizeof(double) * state.V.size());
+    out.write(reinterpret_cast<const char *>(state.centroids.data()), sizeof(double) * state.centroids.size());
+    out.close();
+    if (!out || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+/*
+Read a state written by WriteWarmState. Returns false with the reason in
+`error` when the file is missing or malformed.
+*/
+inline bool ReadWarmState(const std::string &path, WarmState &state, std::string &error)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+        error = "no warm-start state at " + path;
+        return false;
+    }
+    uint64_t fileSize = (uint64_t) in.tellg();
+    in.seekg(0);
+
+    WarmHeader header;
+    if (fileSize < sizeof(header) || !in.read(reinterpret_cast<char *>(&header), sizeof(header))
+        || memcmp(header.magic, WarmMagic, sizeof(WarmMagic)) != 0 || header.version != WarmVersion
+        || header.rows < 0 || header.cols < 0 || header.rank < (int64_t) header.clusters + 1
+        || fileSize != sizeof(header) + header.labelsSize
+                       + sizeof(double) * ((header.rank + 1) * (header.rows + header.cols) + header.rank
+                                           + (uint64_t) header.clusters * header.clusters))
+    {
+        error = path + " is not a valid warm-start state";
+        return false;
+    }
+
+    std::string labels(header.labelsSize, '\0');
+    in.read(&labels[0], labels.size());
+    size_t position = 0;
+    state.rowLabels.clear();
+    state.columnLabels.clear();
+    for (std::vector<std::string> *list : {&state.rowLabels, &state.columnLabels})
+    {
+        int64_t count = list == &state.rowLabels ? header.rows : header.cols;
+        for (int64_t i = 0; i < count && position < labels.size(); i++)
+        {
+            uint32_t length;
+            if (position + sizeof(length) > labels.size())
+            {
+                break;
+            }
+            memcpy(&length, labels.data() + position, sizeof(length));
+            position += sizeof(length);
+            if (position + length > labels.size())
+            {
+                break;
+            }
+            list->emplace_back(labels, position, length);
+            position += length;
+        }
+    }
+    if (position != labels.size() || (!labels.empty() && ((int64_t) state.rowLabels.size() != header.rows
+                                                          || (int64_t) state.columnLabels.size() != header.cols)))
+    {
+        error = path + " is not a valid warm-start state";
+        return false;
+    }
+
+    state.bistochastic = header.bistochastic != 0;
+    state.singularValues.resize(header.rank);
+    state.rowScale.resize(header.rows);
+    state.colScale.resize(header.cols);
+    state.U.resize(header.rows, header.rank);
+    state.V.resize(header.cols, header.rank);
+    state.centroids.resize(header.clusters, header.clusters);
+    in.read(reinterpret_cast<char *>(state.singularValues.data()), sizeof(double) * state.singularValues.size());
+    in.read(reinterpret_cast<char *>(state.rowScale.data()), sizeof(double) * state.rowScale.size());
+    in.read(reinterpret_cast<char *>(state.colScale.data()), sizeof(double) * state.colScale.size());
+    in.read(reinterpret_cast<char *>(state.U.data()), sizeof(double) * state.U.size());
+    in.read(reinterpret_cast<char *>(state.V.data()), sizeof(double) * state.V.size());
+    in.read(reinterpret_cast<char *>(state.centroids.data()), sizeof(double) * state.centroids.size());
+    if (!in)
+    {
+        error = path + " is truncated";
+        return false;
+    }
+    return true;
+}